@@ -16,6 +16,8 @@
 // 
 // Please email: vagabond @ hginn.co.uk for more details.
 
+#include "RefreshQueue.h"
+
 /* holds a pointer and will provide getters and setters for any
  * double of your choice */
 
@@ -32,6 +34,7 @@ public:
 		_value = 0;
 		_g = NULL;
 		_gobj = NULL;
+		_queue = NULL;
 	}
 	
 	static double get(void *object)
@@ -46,7 +49,11 @@ public:
 		double aim = _initial + val * _scale;
 		*_ptr = aim;
 
-		if (_g != NULL)
+		if (_g != NULL && _queue != NULL)
+		{
+			_queue->mark(_g, _gobj);
+		}
+		else if (_g != NULL)
 		{
 			(*_g)(_gobj);
 		}
@@ -63,6 +70,13 @@ public:
 		_g = g;
 		_gobj = object;
 	}
+	
+	/* while the queue is deferring, the refresh is left to its next
+	 * flush, e.g. RefinementStrategy::refreshQueue() */
+	void setRefreshQueue(RefreshQueue *queue)
+	{
+		_queue = queue;
+	}
 
 private:
 	double *_ptr;
@@ -71,6 +85,7 @@ private:
 	double _scale;
 	Refresh _g;
 	void *_gobj;
+	RefreshQueue *_queue;
 
 };
 
@@ -0,0 +1,94 @@
+// Vagabond
+// Copyright (C) 2019 Helen Ginn
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+// Please email: vagabond @ hginn.co.uk for more details.
+
+#include "AsyncEvaluator.h"
+#include "ThreadPool.h"
+#include <limits>
+#include <chrono>
+
+AsyncEvaluator::AsyncEvaluator(AsyncScore score, int inFlight)
+{
+	_score = score;
+	_inFlight = (inFlight > 0 ? inFlight : ThreadPool::hardwareThreads());
+	_object = NULL;
+}
+
+void AsyncEvaluator::collect(Pending &pending, double *scores)
+{
+	double score = std::numeric_limits<double>::quiet_NaN();
+
+	if (pending.second.valid())
+	{
+		try
+		{
+			score = pending.second.get();
+		}
+		catch (...)
+		{
+
+		}
+	}
+
+	scores[pending.first] = score;
+}
+
+void AsyncEvaluator::evaluate(size_t count, size_t n, const PointFill &fill,
+                              double *scores)
+{
+	_vals.resize(n);
+	_pending.clear();
+
+	for (size_t idx = 0; idx < count; idx++)
+	{
+		/* full: take any which has finished, or else wait on the oldest */
+		while ((int)_pending.size() >= _inFlight)
+		{
+			bool found = false;
+
+			for (size_t i = 0; i < _pending.size(); i++)
+			{
+				std::future<double> &f = _pending[i].second;
+
+				if (!f.valid() || f.wait_for(std::chrono::seconds(0)) ==
+				    std::future_status::ready)
+				{
+					collect(_pending[i], scores);
+					_pending.erase(_pending.begin() + i);
+					found = true;
+					break;
+				}
+			}
+
+			if (!found)
+			{
+				collect(_pending.front(), scores);
+				_pending.pop_front();
+			}
+		}
+
+		fill(idx, _vals.data());
+		_pending.push_back(Pending(idx, (*_score)(_object, _vals.data(), n)));
+	}
+
+	for (size_t i = 0; i < _pending.size(); i++)
+	{
+		collect(_pending[i], scores);
+	}
+
+	_pending.clear();
+}
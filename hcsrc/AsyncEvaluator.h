@@ -0,0 +1,84 @@
+// Vagabond
+// Copyright (C) 2019 Helen Ginn
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+// Please email: vagabond @ hginn.co.uk for more details.
+
+#ifndef __vagabond__AsyncEvaluator__
+#define __vagabond__AsyncEvaluator__
+
+#include <deque>
+#include <vector>
+#include <future>
+#include "BatchEvaluator.h"
+
+/* starts scoring the n parameter values on the object and returns at
+ * once. vals is only valid during the call, so copy what is needed. */
+typedef std::future<double> (*AsyncScore)(void *object, const double *vals,
+                                          size_t n);
+
+/** \class AsyncEvaluator
+ *  \brief Scores batches with an objective which hands back a future,
+ *  such as one waiting on a solver subprocess or on disk, keeping up to
+ *  a fixed number of points in flight so that their waits overlap.
+ *
+ *  Every point is given the original object, so the objective must cope
+ *  with several calls being outstanding on it at once. A future which
+ *  throws, or is not valid, scores NaN.
+ **/
+
+class AsyncEvaluator : public BatchEvaluator
+{
+public:
+	/* inFlight of zero or less means one per hardware thread */
+	AsyncEvaluator(AsyncScore score, int inFlight);
+
+	virtual int threadCount()
+	{
+		return _inFlight;
+	}
+
+	virtual bool hasClones()
+	{
+		return _object != NULL;
+	}
+
+	/* no copies are made; the original is used for every point */
+	virtual void makeClones(void *original)
+	{
+		_object = original;
+	}
+
+	virtual void releaseClones()
+	{
+		_object = NULL;
+	}
+
+	virtual void evaluate(size_t count, size_t n, const PointFill &fill,
+	                      double *scores);
+private:
+	typedef std::pair<size_t, std::future<double> > Pending;
+
+	void collect(Pending &pending, double *scores);
+
+	AsyncScore _score;
+	int _inFlight;
+	void *_object;
+
+	std::deque<Pending> _pending;
+	std::vector<double> _vals;
+};
+
+#endif
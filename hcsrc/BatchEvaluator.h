@@ -0,0 +1,61 @@
+// Vagabond
+// Copyright (C) 2019 Helen Ginn
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+// Please email: vagabond @ hginn.co.uk for more details.
+
+#ifndef __vagabond__BatchEvaluator__
+#define __vagabond__BatchEvaluator__
+
+#include <cstddef>
+#include <functional>
+#include <boost/shared_ptr.hpp>
+
+/* applies all n parameter values to the clone and returns its score */
+typedef double (*VectorScore)(void *clone, const double *vals, size_t n);
+
+/* writes the n parameter values of point number idx into vals */
+typedef std::function<void (size_t idx, double *vals)> PointFill;
+
+/** \class BatchEvaluator
+ *  \brief Interface for backends which score many independent parameter
+ *  vectors at once for a RefinementStrategy, each on a copy of the
+ *  model of its own.
+ **/
+
+class BatchEvaluator
+{
+public:
+	virtual ~BatchEvaluator() {};
+
+	/* number of points which may be scored at the same time */
+	virtual int threadCount() = 0;
+
+	virtual bool hasClones() = 0;
+
+	/* throws away any old copies and makes new ones from the current
+	 * state of the original object */
+	virtual void makeClones(void *original) = 0;
+	virtual void releaseClones() = 0;
+
+	/* fills in scores[i] for i in [0, count), each point having n
+	 * parameters provided by fill */
+	virtual void evaluate(size_t count, size_t n, const PointFill &fill,
+	                      double *scores) = 0;
+};
+
+typedef boost::shared_ptr<BatchEvaluator> BatchEvaluatorPtr;
+
+#endif
@@ -0,0 +1,126 @@
+// Vagabond
+// Copyright (C) 2019 Helen Ginn
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+// Please email: vagabond @ hginn.co.uk for more details.
+
+#ifndef __vagabond__Checkpoint__
+#define __vagabond__Checkpoint__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <iostream>
+
+/* Raw binary helpers for checkpoint files. Values are written in the
+ * byte order of the machine, so files are only meant to be read back by
+ * the same build which wrote them. */
+
+template <class T>
+void writeBinary(std::ostream &out, const T &value)
+{
+	out.write((const char *)&value, sizeof(T));
+}
+
+template <class T>
+bool readBinary(std::istream &in, T &value)
+{
+	in.read((char *)&value, sizeof(T));
+	return !in.fail();
+}
+
+/* true if at least length bytes are left to read, so that a corrupt
+ * length is caught before anything is allocated for it. Streams which
+ * cannot seek are given the benefit of the doubt. */
+inline bool bytesLeft(std::istream &in, uint64_t length)
+{
+	std::streampos here = in.tellg();
+	if (here < 0)
+	{
+		in.clear();
+		return true;
+	}
+
+	in.seekg(0, std::ios::end);
+	std::streampos end = in.tellg();
+	in.seekg(here);
+
+	if (end < 0 || !in)
+	{
+		in.clear();
+		in.seekg(here);
+		return true;
+	}
+
+	return (uint64_t)(end - here) >= length;
+}
+
+/* length as uint64, then the elements; T must be plain data */
+template <class T>
+void writeBinaryVector(std::ostream &out, const std::vector<T> &values)
+{
+	writeBinary(out, (uint64_t)values.size());
+
+	if (values.size())
+	{
+		out.write((const char *)&values[0], values.size() * sizeof(T));
+	}
+}
+
+template <class T>
+bool readBinaryVector(std::istream &in, std::vector<T> &values)
+{
+	uint64_t size = 0;
+	if (!readBinary(in, size) || size > UINT64_MAX / sizeof(T) ||
+	    !bytesLeft(in, size * sizeof(T)))
+	{
+		return false;
+	}
+
+	values.resize(size);
+
+	if (size)
+	{
+		in.read((char *)&values[0], size * sizeof(T));
+	}
+
+	return !in.fail();
+}
+
+inline void writeBinaryString(std::ostream &out, const std::string &str)
+{
+	writeBinary(out, (uint64_t)str.length());
+	out.write(str.c_str(), str.length());
+}
+
+inline bool readBinaryString(std::istream &in, std::string &str)
+{
+	uint64_t size = 0;
+	if (!readBinary(in, size) || !bytesLeft(in, size))
+	{
+		return false;
+	}
+
+	str.resize(size);
+
+	if (size)
+	{
+		in.read(&str[0], size);
+	}
+
+	return !in.fail();
+}
+
+#endif
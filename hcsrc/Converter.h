@@ -22,8 +22,6 @@
 #include "Param.h"
 #include "RefinementStrategy.h"
 
-typedef boost::shared_ptr<RefinementStrategy> RefinementStrategyPtr;
-
 /** \brief Allows conversion between parameter sets */
 
 typedef struct
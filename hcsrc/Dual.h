@@ -0,0 +1,353 @@
+// Vagabond
+// Copyright (C) 2019 Helen Ginn
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+// Please email: vagabond @ hginn.co.uk for more details.
+
+#ifndef __vagabond__Dual__
+#define __vagabond__Dual__
+
+#include <cmath>
+#include <vector>
+#include <cstddef>
+
+/** \class Dual
+ *  \brief A value carried together with its derivatives with respect to
+ *  N chosen variables, for forward-mode automatic differentiation.
+ *
+ *  Code written as a template over its number type, calling sqrt() and
+ *  friends unqualified, gives plain results for double and exact
+ *  derivatives for Dual<N>. Comparisons look at the value alone.
+ **/
+
+template <int N>
+class Dual
+{
+public:
+	Dual()
+	{
+		v = 0;
+		zero();
+	}
+
+	/* a constant, with no dependence on any variable */
+	Dual(double value)
+	{
+		v = value;
+		zero();
+	}
+
+	/* variable number i of the N */
+	static Dual variable(double value, int i)
+	{
+		Dual x(value);
+		x.d[i] = 1;
+		return x;
+	}
+
+	void zero()
+	{
+		for (int i = 0; i < N; i++)
+		{
+			d[i] = 0;
+		}
+	}
+
+	Dual &operator+=(const Dual &b)
+	{
+		v += b.v;
+		for (int i = 0; i < N; i++) d[i] += b.d[i];
+		return *this;
+	}
+
+	Dual &operator-=(const Dual &b)
+	{
+		v -= b.v;
+		for (int i = 0; i < N; i++) d[i] -= b.d[i];
+		return *this;
+	}
+
+	Dual &operator*=(const Dual &b)
+	{
+		for (int i = 0; i < N; i++) d[i] = d[i] * b.v + v * b.d[i];
+		v *= b.v;
+		return *this;
+	}
+
+	Dual &operator/=(const Dual &b)
+	{
+		double inv = 1 / b.v;
+		v *= inv;
+		for (int i = 0; i < N; i++) d[i] = (d[i] - v * b.d[i]) * inv;
+		return *this;
+	}
+
+	Dual &operator+=(double b)
+	{
+		v += b;
+		return *this;
+	}
+
+	Dual &operator-=(double b)
+	{
+		v -= b;
+		return *this;
+	}
+
+	Dual &operator*=(double b)
+	{
+		v *= b;
+		for (int i = 0; i < N; i++) d[i] *= b;
+		return *this;
+	}
+
+	Dual &operator/=(double b)
+	{
+		return (*this *= (1 / b));
+	}
+
+	double v;
+	double d[N];
+};
+
+/* the value of a double or Dual, for code templated over either */
+inline double dual_value(double x)
+{
+	return x;
+}
+
+template <int N>
+inline double dual_value(const Dual<N> &x)
+{
+	return x.v;
+}
+
+/* result with value f and derivative df/dx times those of x */
+template <int N>
+inline Dual<N> dual_chain(const Dual<N> &x, double f, double dfdx)
+{
+	Dual<N> r(f);
+	for (int i = 0; i < N; i++) r.d[i] = dfdx * x.d[i];
+	return r;
+}
+
+template <int N>
+inline Dual<N> operator-(const Dual<N> &a)
+{
+	return dual_chain(a, -a.v, -1);
+}
+
+template <int N>
+inline Dual<N> operator+(Dual<N> a, const Dual<N> &b) { return a += b; }
+template <int N>
+inline Dual<N> operator-(Dual<N> a, const Dual<N> &b) { return a -= b; }
+template <int N>
+inline Dual<N> operator*(Dual<N> a, const Dual<N> &b) { return a *= b; }
+template <int N>
+inline Dual<N> operator/(Dual<N> a, const Dual<N> &b) { return a /= b; }
+
+template <int N>
+inline Dual<N> operator+(Dual<N> a, double b) { return a += b; }
+template <int N>
+inline Dual<N> operator-(Dual<N> a, double b) { return a -= b; }
+template <int N>
+inline Dual<N> operator*(Dual<N> a, double b) { return a *= b; }
+template <int N>
+inline Dual<N> operator/(Dual<N> a, double b) { return a /= b; }
+
+template <int N>
+inline Dual<N> operator+(double a, Dual<N> b) { return b += a; }
+template <int N>
+inline Dual<N> operator-(double a, const Dual<N> &b) { return -b + a; }
+template <int N>
+inline Dual<N> operator*(double a, Dual<N> b) { return b *= a; }
+template <int N>
+inline Dual<N> operator/(double a, const Dual<N> &b)
+{
+	return dual_chain(b, a / b.v, -a / (b.v * b.v));
+}
+
+#define DUAL_COMPARE(OP) \
+template <int N> \
+inline bool operator OP(const Dual<N> &a, const Dual<N> &b) \
+{ return a.v OP b.v; } \
+template <int N> \
+inline bool operator OP(const Dual<N> &a, double b) { return a.v OP b; } \
+template <int N> \
+inline bool operator OP(double a, const Dual<N> &b) { return a OP b.v; }
+
+DUAL_COMPARE(<)
+DUAL_COMPARE(>)
+DUAL_COMPARE(<=)
+DUAL_COMPARE(>=)
+DUAL_COMPARE(==)
+DUAL_COMPARE(!=)
+
+#undef DUAL_COMPARE
+
+template <int N>
+inline Dual<N> sqrt(const Dual<N> &x)
+{
+	double s = std::sqrt(x.v);
+	return dual_chain(x, s, 0.5 / s);
+}
+
+template <int N>
+inline Dual<N> exp(const Dual<N> &x)
+{
+	double e = std::exp(x.v);
+	return dual_chain(x, e, e);
+}
+
+template <int N>
+inline Dual<N> log(const Dual<N> &x)
+{
+	return dual_chain(x, std::log(x.v), 1 / x.v);
+}
+
+template <int N>
+inline Dual<N> pow(const Dual<N> &x, double p)
+{
+	double f = std::pow(x.v, p);
+	return dual_chain(x, f, p * std::pow(x.v, p - 1));
+}
+
+template <int N>
+inline Dual<N> sin(const Dual<N> &x)
+{
+	return dual_chain(x, std::sin(x.v), std::cos(x.v));
+}
+
+template <int N>
+inline Dual<N> cos(const Dual<N> &x)
+{
+	return dual_chain(x, std::cos(x.v), -std::sin(x.v));
+}
+
+template <int N>
+inline Dual<N> tan(const Dual<N> &x)
+{
+	double t = std::tan(x.v);
+	return dual_chain(x, t, 1 + t * t);
+}
+
+template <int N>
+inline Dual<N> asin(const Dual<N> &x)
+{
+	return dual_chain(x, std::asin(x.v), 1 / std::sqrt(1 - x.v * x.v));
+}
+
+template <int N>
+inline Dual<N> acos(const Dual<N> &x)
+{
+	return dual_chain(x, std::acos(x.v), -1 / std::sqrt(1 - x.v * x.v));
+}
+
+template <int N>
+inline Dual<N> atan(const Dual<N> &x)
+{
+	return dual_chain(x, std::atan(x.v), 1 / (1 + x.v * x.v));
+}
+
+template <int N>
+inline Dual<N> atan2(const Dual<N> &y, const Dual<N> &x)
+{
+	double r2 = x.v * x.v + y.v * y.v;
+	Dual<N> r(std::atan2(y.v, x.v));
+	for (int i = 0; i < N; i++) r.d[i] = (x.v * y.d[i] - y.v * x.d[i]) / r2;
+	return r;
+}
+
+template <int N>
+inline Dual<N> fabs(const Dual<N> &x)
+{
+	return (x.v < 0 ? -x : x);
+}
+
+/** \class DualGradient
+ *  \brief Gradients of a generic objective by forward sweeps of
+ *  Dual<N>, N parameters at a time.
+ *
+ *  F must provide template <class T> T operator()(const T *x, size_t n),
+ *  the score for the n parameter values x. The whole gradient then costs
+ *  n / N (rounded up) calls with Dual<N>, with no finite differences.
+ *  For RefinementLBFGS:
+ *  lbfgs.setVectorGradient(DualGradient<8, F>::gradient, &adapter);
+ **/
+
+template <int N, class F>
+class DualGradient
+{
+public:
+	DualGradient(F &f) : _f(f)
+	{
+
+	}
+
+	/* VectorGradient with a DualGradient as its object */
+	static double gradient(void *object, const double *x, double *g, int n)
+	{
+		return static_cast<DualGradient *>(object)->sweep(x, g, n);
+	}
+
+	/* VectorScore with a DualGradient as its object, for clones */
+	static double score(void *object, const double *x, size_t n)
+	{
+		return static_cast<DualGradient *>(object)->_f(x, n);
+	}
+
+	double sweep(const double *x, double *g, int n)
+	{
+		_xs.resize(n);
+
+		for (int i = 0; i < n; i++)
+		{
+			_xs[i] = Dual<N>(x[i]);
+		}
+
+		if (n == 0)
+		{
+			return dual_value(_f(x, 0));
+		}
+
+		double value = 0;
+
+		for (int start = 0; start < n; start += N)
+		{
+			int end = (start + N < n ? start + N : n);
+
+			for (int i = start; i < end; i++)
+			{
+				_xs[i].d[i - start] = 1;
+			}
+
+			Dual<N> result = _f(&_xs[0], (size_t)n);
+			value = result.v;
+
+			for (int i = start; i < end; i++)
+			{
+				g[i] = result.d[i - start];
+				_xs[i].d[i - start] = 0;
+			}
+		}
+
+		return value;
+	}
+private:
+	F &_f;
+	std::vector<Dual<N> > _xs;
+};
+
+#endif
@@ -0,0 +1,92 @@
+// Vagabond
+// Copyright (C) 2019 Helen Ginn
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+// Please email: vagabond @ hginn.co.uk for more details.
+
+#include "EvaluationPool.h"
+#include <algorithm>
+
+EvaluationPool::EvaluationPool(int threads, CloneFactory factory,
+                               VectorScore score, CloneRelease release)
+: _pool(threads)
+{
+	_factory = factory;
+	_score = score;
+	_release = release;
+}
+
+EvaluationPool::~EvaluationPool()
+{
+	releaseClones();
+}
+
+void EvaluationPool::makeClones(void *original)
+{
+	releaseClones();
+
+	/* factories are not expected to be thread-safe, so clones are made
+	 * one after another on the calling thread */
+	for (int i = 0; i < threadCount(); i++)
+	{
+		_clones.push_back((*_factory)(original));
+	}
+
+	_scratch.resize(threadCount());
+}
+
+void EvaluationPool::releaseClones()
+{
+	if (_release != NULL)
+	{
+		for (size_t i = 0; i < _clones.size(); i++)
+		{
+			(*_release)(_clones[i]);
+		}
+	}
+
+	_clones.clear();
+}
+
+void EvaluationPool::evaluate(size_t count, size_t n, const PointFill &fill,
+                              double *scores)
+{
+	for (size_t i = 0; i < _scratch.size(); i++)
+	{
+		_scratch[i].resize(n);
+	}
+
+	/* contiguous chunks keep neighbouring points on the same worker and
+	 * spare the workers from fighting over every single index */
+	size_t grain = count / (threadCount() * 4);
+	if (grain == 0)
+	{
+		grain = 1;
+	}
+
+	size_t chunks = (count + grain - 1) / grain;
+
+	_pool.run(chunks, [&](size_t chunk, int worker)
+	{
+		double *vals = &_scratch[worker][0];
+		size_t end = std::min(count, (chunk + 1) * grain);
+
+		for (size_t idx = chunk * grain; idx < end; idx++)
+		{
+			fill(idx, vals);
+			scores[idx] = (*_score)(_clones[worker], vals, n);
+		}
+	});
+}
@@ -0,0 +1,73 @@
+// Vagabond
+// Copyright (C) 2019 Helen Ginn
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+// Please email: vagabond @ hginn.co.uk for more details.
+
+#ifndef __vagabond__EvaluationPool__
+#define __vagabond__EvaluationPool__
+
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include "BatchEvaluator.h"
+#include "ThreadPool.h"
+
+/* makes an independent copy of the evaluated object for one worker */
+typedef void *(*CloneFactory)(void *original);
+
+/* frees a copy made by the CloneFactory */
+typedef void (*CloneRelease)(void *clone);
+
+/** \class EvaluationPool
+ *  \brief Scores batches of independent parameter vectors over a set of
+ *  worker threads, each of which owns its own clone of the model.
+ **/
+
+class EvaluationPool : public BatchEvaluator
+{
+public:
+	EvaluationPool(int threads, CloneFactory factory, VectorScore score,
+	               CloneRelease release = NULL);
+	~EvaluationPool();
+
+	virtual int threadCount()
+	{
+		return _pool.threadCount();
+	}
+
+	virtual bool hasClones()
+	{
+		return _clones.size() > 0;
+	}
+
+	/* one clone per worker, made by the CloneFactory */
+	virtual void makeClones(void *original);
+	virtual void releaseClones();
+
+	virtual void evaluate(size_t count, size_t n, const PointFill &fill,
+	                      double *scores);
+private:
+	ThreadPool _pool;
+	CloneFactory _factory;
+	VectorScore _score;
+	CloneRelease _release;
+
+	std::vector<void *> _clones;
+	std::vector<std::vector<double> > _scratch;
+};
+
+typedef boost::shared_ptr<EvaluationPool> EvaluationPoolPtr;
+
+#endif
@@ -0,0 +1,198 @@
+// Vagabond
+// Copyright (C) 2019 Helen Ginn
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+// Please email: vagabond @ hginn.co.uk for more details.
+
+#include "ParameterTable.h"
+#include "FileReader.h"
+#include <cstddef>
+
+ParameterTable::ParameterTable()
+{
+
+}
+
+void ParameterTable::reserve(size_t n)
+{
+	_objects.reserve(n);
+	_getters.reserve(n);
+	_setters.reserve(n);
+	_gradients.reserve(n);
+	_direct.reserve(n);
+	_steps.reserve(n);
+	_others.reserve(n);
+	_starts.reserve(n);
+	_tags.reserve(n);
+	_coupled.reserve(n);
+	_changed.reserve(n);
+	_terms.reserve(n);
+	_blocks.reserve(n);
+	_blockIndex.reserve(n);
+	_blockSize.reserve(n);
+}
+
+long ParameterTable::internTag(const std::string &tag)
+{
+	if (!tag.length())
+	{
+		return -(long)size() - 1;
+	}
+
+	std::unordered_map<std::string, long>::iterator it = _tagIds.find(tag);
+
+	if (it != _tagIds.end())
+	{
+		return it->second;
+	}
+
+	long id = _tagNames.size();
+	_tagNames.push_back(tag);
+	_tagIds[tag] = id;
+
+	return id;
+}
+
+std::string ParameterTable::tag(size_t i) const
+{
+	long id = _tags[i];
+
+	if (id < 0)
+	{
+		return "object" + i_to_str((int)(-id - 1));
+	}
+
+	return _tagNames[id];
+}
+
+void ParameterTable::add(void *object, Getter getter, Setter setter,
+                         Getter gradient, double stepSize, 
+                         double otherValue, const std::string &tag)
+{
+	_tags.push_back(internTag(tag));
+	_objects.push_back(object);
+	_getters.push_back(getter);
+	_setters.push_back(setter);
+	_gradients.push_back(gradient);
+	_direct.push_back(getter == &directGetter && setter == &directSetter ?
+	                  static_cast<double *>(object) : NULL);
+	_steps.push_back(stepSize);
+	_others.push_back(otherValue);
+	_starts.push_back(0);
+	_coupled.push_back(1);
+	_changed.push_back(0);
+	_terms.push_back(std::vector<int>());
+	_blocks.push_back(NULL);
+	_blockIndex.push_back(0);
+	_blockSize.push_back(1);
+}
+
+double ParameterTable::directGetter(void *object)
+{
+	return *static_cast<double *>(object);
+}
+
+void ParameterTable::directSetter(void *object, double value)
+{
+	*static_cast<double *>(object) = value;
+}
+
+void ParameterTable::add(double *value, double stepSize, double otherValue,
+                         const std::string &tag)
+{
+	add(value, &directGetter, &directSetter, NULL, stepSize, otherValue, 
+	    tag);
+}
+
+void ParameterTable::add(const Parameter &param)
+{
+	add(param.object, param.getter, param.setter, param.gradient,
+	    param.step_size, param.other_value, param.tag);
+
+	size_t i = size() - 1;
+	_starts[i] = param.start_value;
+	_coupled[i] = param.coupled;
+	_changed[i] = param.changed;
+	_terms[i] = param.terms;
+	setBlock(i, param.block, param.block_index, param.block_size);
+}
+
+Parameter ParameterTable::parameter(size_t i) const
+{
+	Parameter param;
+	param.object = _objects[i];
+	param.getter = _getters[i];
+	param.gradient = _gradients[i];
+	param.setter = _setters[i];
+	param.step_size = _steps[i];
+	param.other_value = _others[i];
+	param.start_value = _starts[i];
+	param.tag = tag(i);
+	param.coupled = _coupled[i];
+	param.changed = _changed[i];
+	param.terms = _terms[i];
+	param.block = _blocks[i];
+	param.block_index = _blockIndex[i];
+	param.block_size = _blockSize[i];
+
+	return param;
+}
+
+void ParameterTable::setBlock(size_t i, BlockSetter block, int index, 
+                              int size)
+{
+	_blocks[i] = block;
+	_blockIndex[i] = index;
+	_blockSize[i] = size;
+}
+
+void ParameterTable::erase(size_t i)
+{
+	/* automatic tags keep the name they were given */
+	_objects.erase(_objects.begin() + i);
+	_getters.erase(_getters.begin() + i);
+	_setters.erase(_setters.begin() + i);
+	_gradients.erase(_gradients.begin() + i);
+	_direct.erase(_direct.begin() + i);
+	_steps.erase(_steps.begin() + i);
+	_others.erase(_others.begin() + i);
+	_starts.erase(_starts.begin() + i);
+	_tags.erase(_tags.begin() + i);
+	_coupled.erase(_coupled.begin() + i);
+	_changed.erase(_changed.begin() + i);
+	_terms.erase(_terms.begin() + i);
+	_blocks.erase(_blocks.begin() + i);
+	_blockIndex.erase(_blockIndex.begin() + i);
+	_blockSize.erase(_blockSize.begin() + i);
+}
+
+void ParameterTable::clear()
+{
+	_objects.clear();
+	_getters.clear();
+	_setters.clear();
+	_gradients.clear();
+	_direct.clear();
+	_steps.clear();
+	_others.clear();
+	_starts.clear();
+	_tags.clear();
+	_coupled.clear();
+	_changed.clear();
+	_terms.clear();
+	_blocks.clear();
+	_blockIndex.clear();
+	_blockSize.clear();
+}
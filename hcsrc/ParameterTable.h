@@ -0,0 +1,232 @@
+// Vagabond
+// Copyright (C) 2019 Helen Ginn
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+// Please email: vagabond @ hginn.co.uk for more details.
+
+#ifndef __vagabond__ParameterTable__
+#define __vagabond__ParameterTable__
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+typedef double (*Getter)(void *);
+typedef void (*Setter)(void *, double newValue);
+typedef void (*BlockSetter)(void *, const double *vals, size_t n);
+
+/* one parameter copied out of a ParameterTable, or to be put into one */
+typedef struct
+{
+	void *object;
+	Getter getter;
+	Getter gradient;
+	Setter setter;
+	double step_size;
+	double other_value;
+	double start_value;
+	std::string tag;
+	int coupled;
+	int changed;
+	std::vector<int> terms; /* score terms it affects, or empty for all */
+	BlockSetter block; /* sets the whole block this is part of */
+	int block_index;
+	int block_size;
+} Parameter;
+
+/* type-safe getters and setters built from member functions, for
+ * RefinementStrategy::addParameter<T, &T::get, &T::set>() */
+template <class T, double (T::*get)()>
+double bound_getter(void *object)
+{
+	return (static_cast<T *>(object)->*get)();
+}
+
+template <class T, double (T::*get)() const>
+double bound_const_getter(void *object)
+{
+	return (static_cast<T *>(object)->*get)();
+}
+
+template <class T, void (T::*set)(double)>
+void bound_setter(void *object, double value)
+{
+	(static_cast<T *>(object)->*set)(value);
+}
+
+/** \class ParameterTable
+ *  \brief Parameters of a refinement held column by column, so that
+ *  loops over step sizes or tolerances run along contiguous doubles.
+ *
+ *  Tags are interned: each distinct tag string is stored once and the
+ *  table keeps its number. Parameters added without a tag are named
+ *  "object" plus the number of parameters before them, but the string
+ *  is only made when asked for.
+ **/
+
+class ParameterTable
+{
+public:
+	ParameterTable();
+
+	size_t size() const
+	{
+		return _objects.size();
+	}
+
+	void reserve(size_t n);
+
+	/* an empty tag gives the automatic name */
+	void add(void *object, Getter getter, Setter setter, Getter gradient,
+	         double stepSize, double otherValue, const std::string &tag);
+
+	/* bound straight to a double, read and written without calls */
+	void add(double *value, double stepSize, double otherValue, 
+	         const std::string &tag);
+	void add(const Parameter &param);
+	Parameter parameter(size_t i) const;
+	void erase(size_t i);
+
+	/* interned tags are kept, so tag numbers stay the same */
+	void clear();
+
+	void *object(size_t i) const
+	{
+		return _objects[i];
+	}
+
+	Getter getter(size_t i) const
+	{
+		return _getters[i];
+	}
+
+	Setter setter(size_t i) const
+	{
+		return _setters[i];
+	}
+
+	Getter gradient(size_t i) const
+	{
+		return _gradients[i];
+	}
+
+	/* the double a parameter is bound to, or NULL if it has to go
+	 * through its getter and setter */
+	double *direct(size_t i) const
+	{
+		return _direct[i];
+	}
+
+	/* getter and setter given to directly bound parameters, so that
+	 * copies of them as Parameters still work */
+	static double directGetter(void *object);
+	static void directSetter(void *object, double value);
+
+	double &stepSize(size_t i)
+	{
+		return _steps[i];
+	}
+
+	double &otherValue(size_t i)
+	{
+		return _others[i];
+	}
+
+	double &startValue(size_t i)
+	{
+		return _starts[i];
+	}
+
+	/* contiguous spans of size() values */
+	double *stepSizes()
+	{
+		return _steps.data();
+	}
+
+	double *otherValues()
+	{
+		return _others.data();
+	}
+
+	double *startValues()
+	{
+		return _starts.data();
+	}
+
+	int &coupled(size_t i)
+	{
+		return _coupled[i];
+	}
+
+	int &changed(size_t i)
+	{
+		return _changed[i];
+	}
+
+	std::vector<int> &terms(size_t i)
+	{
+		return _terms[i];
+	}
+
+	BlockSetter block(size_t i) const
+	{
+		return _blocks[i];
+	}
+
+	int blockIndex(size_t i) const
+	{
+		return _blockIndex[i];
+	}
+
+	int blockSize(size_t i) const
+	{
+		return _blockSize[i];
+	}
+
+	void setBlock(size_t i, BlockSetter block, int index, int size);
+
+	std::string tag(size_t i) const;
+
+	/* equal numbers mean equal tags, for tags of the same table */
+	long tagId(size_t i) const
+	{
+		return _tags[i];
+	}
+private:
+	long internTag(const std::string &tag);
+
+	std::vector<void *> _objects;
+	std::vector<Getter> _getters;
+	std::vector<Setter> _setters;
+	std::vector<Getter> _gradients;
+	std::vector<double *> _direct;
+	std::vector<double> _steps;
+	std::vector<double> _others;
+	std::vector<double> _starts;
+
+	/* index into _tagNames, or -(n + 1) for the automatic "object<n>" */
+	std::vector<long> _tags;
+	std::vector<int> _coupled;
+	std::vector<int> _changed;
+	std::vector<std::vector<int> > _terms;
+	std::vector<BlockSetter> _blocks;
+	std::vector<int> _blockIndex;
+	std::vector<int> _blockSize;
+
+	std::vector<std::string> _tagNames;
+	std::unordered_map<std::string, long> _tagIds;
+};
+
+#endif
@@ -0,0 +1,395 @@
+// Vagabond
+// Copyright (C) 2019 Helen Ginn
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+// Please email: vagabond @ hginn.co.uk for more details.
+
+#include "ProcessPool.h"
+#include "ThreadPool.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <string.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <limits>
+#include <iostream>
+#include <algorithm>
+
+/* Each request is two uint64s, the number of points m and of parameters
+ * n, followed by m * n doubles. The reply is m doubles. A worker exits
+ * when its socket is closed. */
+
+static bool writeAll(int fd, const void *data, size_t length)
+{
+	const char *ptr = (const char *)data;
+	int flags = 0;
+#ifdef MSG_NOSIGNAL
+	flags = MSG_NOSIGNAL;
+#endif
+
+	while (length > 0)
+	{
+		ssize_t done = send(fd, ptr, length, flags);
+
+		if (done < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		else if (done <= 0)
+		{
+			return false;
+		}
+
+		ptr += done;
+		length -= done;
+	}
+
+	return true;
+}
+
+static bool readAll(int fd, void *data, size_t length)
+{
+	char *ptr = (char *)data;
+
+	while (length > 0)
+	{
+		ssize_t done = read(fd, ptr, length);
+
+		if (done < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		else if (done <= 0)
+		{
+			return false;
+		}
+
+		ptr += done;
+		length -= done;
+	}
+
+	return true;
+}
+
+static void serve(int fd, VectorScore score, void *object)
+{
+	std::vector<double> vals, results;
+
+	while (true)
+	{
+		uint64_t header[2];
+
+		if (!readAll(fd, header, sizeof(header)))
+		{
+			break;
+		}
+
+		size_t m = header[0];
+		size_t n = header[1];
+		vals.resize(m * n);
+		results.resize(m);
+
+		if (!readAll(fd, vals.data(), m * n * sizeof(double)))
+		{
+			break;
+		}
+
+		for (size_t i = 0; i < m; i++)
+		{
+			results[i] = (*score)(object, &vals[i * n], n);
+		}
+
+		if (!writeAll(fd, results.data(), m * sizeof(double)))
+		{
+			break;
+		}
+	}
+
+	/* skip the parent's atexit handlers and static destructors */
+	_exit(0);
+}
+
+ProcessPool::ProcessPool(int processes, VectorScore score)
+{
+	_processes = (processes > 0 ? processes : ThreadPool::hardwareThreads());
+	_score = score;
+	_inProcess = false;
+	_original = NULL;
+}
+
+ProcessPool::~ProcessPool()
+{
+	releaseClones();
+}
+
+void ProcessPool::makeClones(void *original)
+{
+	releaseClones();
+
+	/* or buffered output would be written again by every worker */
+	std::cout << std::flush;
+	std::cerr << std::flush;
+	fflush(NULL);
+
+	int error = 0;
+
+	for (int i = 0; i < _processes; i++)
+	{
+		int fds[2];
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+		{
+			error = errno;
+			break;
+		}
+
+		pid_t pid = fork();
+
+		if (pid < 0)
+		{
+			error = errno;
+			close(fds[0]);
+			close(fds[1]);
+			break;
+		}
+		else if (pid == 0)
+		{
+			close(fds[0]);
+			for (size_t j = 0; j < _workers.size(); j++)
+			{
+				close(_workers[j].fd);
+			}
+
+			serve(fds[1], _score, original);
+		}
+
+		close(fds[1]);
+
+#if !defined(MSG_NOSIGNAL) && defined(SO_NOSIGPIPE)
+		int on = 1;
+		setsockopt(fds[0], SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+
+		Worker worker;
+		worker.pid = pid;
+		worker.fd = fds[0];
+		worker.start = 0;
+		worker.count = 0;
+		_workers.push_back(worker);
+	}
+
+	if (_workers.size() == 0)
+	{
+		std::cout << "Warning: could not start worker processes ("
+		<< strerror(error) << "), scoring in this process." << std::endl;
+		_inProcess = true;
+		_original = original;
+	}
+}
+
+void ProcessPool::endWorker(Worker &worker)
+{
+	if (worker.fd < 0)
+	{
+		return;
+	}
+
+	close(worker.fd);
+	waitpid(worker.pid, NULL, 0);
+	worker.fd = -1;
+}
+
+void ProcessPool::releaseClones()
+{
+	for (size_t i = 0; i < _workers.size(); i++)
+	{
+		endWorker(_workers[i]);
+	}
+
+	_workers.clear();
+	_inProcess = false;
+	_original = NULL;
+}
+
+bool ProcessPool::sendChunk(Worker &worker, size_t start, size_t count,
+                            size_t n, const PointFill &fill)
+{
+	worker.start = start;
+	worker.count = count;
+
+	uint64_t header[2] = {count, n};
+	_buffer.resize(count * n);
+
+	for (size_t i = 0; i < count; i++)
+	{
+		fill(start + i, &_buffer[i * n]);
+	}
+
+	return (writeAll(worker.fd, header, sizeof(header)) &&
+	        writeAll(worker.fd, _buffer.data(), count * n * sizeof(double)));
+}
+
+bool ProcessPool::sendNext(Worker &worker, size_t n, const PointFill &fill)
+{
+	if (_todo.size() == 0)
+	{
+		return false;
+	}
+
+	Chunk chunk = _todo.front();
+	_todo.pop_front();
+
+	if (!sendChunk(worker, chunk.first, chunk.second, n, fill))
+	{
+		/* never reached the worker, so another may still score it */
+		_todo.push_front(chunk);
+		endWorker(worker);
+		return false;
+	}
+
+	return true;
+}
+
+void ProcessPool::evaluate(size_t count, size_t n, const PointFill &fill,
+                           double *scores)
+{
+	if (_inProcess)
+	{
+		_buffer.resize(n);
+
+		for (size_t i = 0; i < count; i++)
+		{
+			fill(i, _buffer.data());
+			scores[i] = (*_score)(_original, _buffer.data(), n);
+		}
+
+		return;
+	}
+
+	double nan = std::numeric_limits<double>::quiet_NaN();
+	std::fill(scores, scores + count, nan);
+
+	size_t grain = count / (_processes * 4);
+	if (grain == 0)
+	{
+		grain = 1;
+	}
+
+	_todo.clear();
+	for (size_t start = 0; start < count; start += grain)
+	{
+		_todo.push_back(Chunk(start, std::min(grain, count - start)));
+	}
+
+	std::vector<int> busy;
+
+	for (size_t i = 0; i < _workers.size() && _todo.size(); i++)
+	{
+		if (sendNext(_workers[i], n, fill))
+		{
+			busy.push_back(i);
+		}
+	}
+
+	std::vector<struct pollfd> fds;
+
+	while (busy.size())
+	{
+		fds.resize(busy.size());
+		for (size_t i = 0; i < busy.size(); i++)
+		{
+			fds[i].fd = _workers[busy[i]].fd;
+			fds[i].events = POLLIN;
+			fds[i].revents = 0;
+		}
+
+		if (poll(&fds[0], fds.size(), -1) < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+
+			/* their replies would otherwise be read by the next call */
+			for (size_t i = 0; i < busy.size(); i++)
+			{
+				endWorker(_workers[busy[i]]);
+			}
+
+			break;
+		}
+
+		std::vector<int> stillBusy;
+
+		for (size_t i = 0; i < busy.size(); i++)
+		{
+			Worker &worker = _workers[busy[i]];
+
+			if (fds[i].revents == 0)
+			{
+				stillBusy.push_back(busy[i]);
+				continue;
+			}
+
+			/* the chunk may be what killed the worker, so it is not
+			 * handed on, and keeps its NaN scores */
+			if (!readAll(worker.fd, scores + worker.start,
+			             worker.count * sizeof(double)))
+			{
+				std::fill(scores + worker.start, 
+				          scores + worker.start + worker.count, nan);
+				endWorker(worker);
+				continue;
+			}
+
+			if (sendNext(worker, n, fill))
+			{
+				stillBusy.push_back(busy[i]);
+			}
+		}
+
+		/* chunks left over from failed sends go to idle live workers */
+		for (size_t i = 0; i < _workers.size() && _todo.size(); i++)
+		{
+			if (_workers[i].fd < 0 || std::find(stillBusy.begin(), 
+			    stillBusy.end(), (int)i) != stillBusy.end())
+			{
+				continue;
+			}
+
+			if (sendNext(_workers[i], n, fill))
+			{
+				stillBusy.push_back(i);
+			}
+		}
+
+		busy = stillBusy;
+	}
+
+	/* forget workers which have died, so that fresh ones are forked
+	 * once none are left */
+	std::vector<Worker> alive;
+	for (size_t i = 0; i < _workers.size(); i++)
+	{
+		if (_workers[i].fd >= 0)
+		{
+			alive.push_back(_workers[i]);
+		}
+	}
+
+	_workers = alive;
+}
@@ -0,0 +1,99 @@
+// Vagabond
+// Copyright (C) 2019 Helen Ginn
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+// Please email: vagabond @ hginn.co.uk for more details.
+
+#ifndef __vagabond__ProcessPool__
+#define __vagabond__ProcessPool__
+
+#include <deque>
+#include <vector>
+#include <sys/types.h>
+#include "BatchEvaluator.h"
+
+/** \class ProcessPool
+ *  \brief Scores batches of parameter vectors in forked worker processes,
+ *  for objectives which cannot be run on several threads at once.
+ *
+ *  makeClones() forks each worker from the current state of the model,
+ *  so every worker holds a copy of it in its own address space with no
+ *  clone factory needed. Points go to the workers in chunks over Unix
+ *  sockets and their scores come back the same way. In the worker, score
+ *  is called on the worker's copy of the original object, which is only
+ *  safe if it does not rely on other threads of the parent process.
+ *  Points being scored by a worker when it dies are given a score of
+ *  NaN. Chunks which cannot be sent to a worker go to the others.
+ *  If no worker can be started at all, points are scored one after
+ *  another on the original object in this process instead.
+ **/
+
+class ProcessPool : public BatchEvaluator
+{
+public:
+	/* processes of zero or less means one per hardware thread */
+	ProcessPool(int processes, VectorScore score);
+	~ProcessPool();
+
+	virtual int threadCount()
+	{
+		return _processes;
+	}
+
+	virtual bool hasClones()
+	{
+		return (_workers.size() > 0 || _inProcess);
+	}
+
+	/* forks the workers, after ending any old ones, or falls back to
+	 * scoring in this process if none could be forked */
+	virtual void makeClones(void *original);
+	virtual void releaseClones();
+
+	virtual void evaluate(size_t count, size_t n, const PointFill &fill,
+	                      double *scores);
+private:
+	struct Worker
+	{
+		pid_t pid;
+		int fd;
+
+		/* chunk of points waiting on this worker */
+		size_t start;
+		size_t count;
+	};
+
+	bool sendChunk(Worker &worker, size_t start, size_t count, size_t n,
+	               const PointFill &fill);
+
+	/* sends the next chunk waiting to be scored, if any */
+	bool sendNext(Worker &worker, size_t n, const PointFill &fill);
+	void endWorker(Worker &worker);
+
+	int _processes;
+	VectorScore _score;
+	std::vector<Worker> _workers;
+	std::vector<double> _buffer;
+
+	/* set when no worker could be forked */
+	bool _inProcess;
+	void *_original;
+
+	/* start and length of chunks not yet sent to any worker */
+	typedef std::pair<size_t, size_t> Chunk;
+	std::deque<Chunk> _todo;
+};
+
+#endif
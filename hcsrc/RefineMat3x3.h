@@ -23,8 +23,6 @@
 #include "RefinementStrategy.h"
 #include <boost/shared_ptr.hpp>
 
-typedef boost::shared_ptr<RefinementStrategy> RefinementStrategyPtr;
-
 typedef void (*CleanUp)(void *);
 
 
@@ -35,8 +33,16 @@ public:
 	{
 		_parent = parent;
 		_clean = clean;
+		_queue = NULL;
 		_mat = make_mat3x3();
 	}
+
+	/* while the queue is deferring, clean up is left to its next
+	 * flush, e.g. RefinementStrategy::refreshQueue() */
+	void setRefreshQueue(RefreshQueue *queue)
+	{
+		_queue = queue;
+	}
 	
 	mat3x3 getMat3x3()
 	{
@@ -61,166 +67,148 @@ public:
 	static void setTensor11(void *object, double value)
 	{
 		toMat(object)->_mat.vals[0] = value;
-		if (*toMat(object)->_clean)
-		{
-			(*toMat(object)->_clean)(toMat(object)->_parent);
-		}
+		toMat(object)->cleanUp();
 	}
 
 	static void setTensor12(void *object, double value)
 	{
 		toMat(object)->_mat.vals[1] = value;
 		toMat(object)->_mat.vals[3] = value;
-		if (*toMat(object)->_clean)
-		{
-			(*toMat(object)->_clean)(toMat(object)->_parent);
-		}
+		toMat(object)->cleanUp();
 	}
 
 	static void setTensor21(void *object, double value)
 	{
 		toMat(object)->_mat.vals[3] = value;
-		if (*toMat(object)->_clean)
-		{
-			(*toMat(object)->_clean)(toMat(object)->_parent);
-		}
+		toMat(object)->cleanUp();
 	}
 
 	static void setTensor13(void *object, double value)
 	{
 		toMat(object)->_mat.vals[2] = value;
 		toMat(object)->_mat.vals[6] = value;
-		if (*toMat(object)->_clean)
-		{
-			(*toMat(object)->_clean)(toMat(object)->_parent);
-		}
+		toMat(object)->cleanUp();
 	}
 
 	static void setTensor31(void *object, double value)
 	{
 		toMat(object)->_mat.vals[6] = value;
-		if (*toMat(object)->_clean)
-		{
-			(*toMat(object)->_clean)(toMat(object)->_parent);
-		}
+		toMat(object)->cleanUp();
 	}
 
 	static void setTensor22(void *object, double value)
 	{
 		toMat(object)->_mat.vals[4] = value;
-		if (*toMat(object)->_clean)
-		{
-			(*toMat(object)->_clean)(toMat(object)->_parent);
-		}
+		toMat(object)->cleanUp();
 	}
 
 	static void setTensor32(void *object, double value)
 	{
 		toMat(object)->_mat.vals[7] = value;
-		if (*toMat(object)->_clean)
-		{
-			(*toMat(object)->_clean)(toMat(object)->_parent);
-		}
+		toMat(object)->cleanUp();
 	}
 
 	static void setTensor23(void *object, double value)
 	{
 		toMat(object)->_mat.vals[5] = value;
 		toMat(object)->_mat.vals[7] = value;
-		if (*toMat(object)->_clean)
-		{
-			(*toMat(object)->_clean)(toMat(object)->_parent);
-		}
+		toMat(object)->cleanUp();
 	}
 
 	static void setTensor33(void *object, double value)
 	{
 		toMat(object)->_mat.vals[8] = value;
-		if (*toMat(object)->_clean)
-		{
-			(*toMat(object)->_clean)(toMat(object)->_parent);
-		}
+		toMat(object)->cleanUp();
 	}
 
 	static void setValue11(void *object, double value)
 	{
 		toMat(object)->_mat.vals[0] = value;
-		if (*toMat(object)->_clean)
-		{
-			(*toMat(object)->_clean)(toMat(object)->_parent);
-		}
+		toMat(object)->cleanUp();
 	}
 
 	static void setValue12(void *object, double value)
 	{
 		toMat(object)->_mat.vals[1] = value;
-		if (*toMat(object)->_clean)
-		{
-			(*toMat(object)->_clean)(toMat(object)->_parent);
-		}
+		toMat(object)->cleanUp();
 	}
 
 	static void setValue13(void *object, double value)
 	{
 		toMat(object)->_mat.vals[2] = value;
-		if (*toMat(object)->_clean)
-		{
-			(*toMat(object)->_clean)(toMat(object)->_parent);
-		}
+		toMat(object)->cleanUp();
 	}
 
 	static void setValue21(void *object, double value)
 	{
 		toMat(object)->_mat.vals[3] = value;
-		if (*toMat(object)->_clean)
-		{
-			(*toMat(object)->_clean)(toMat(object)->_parent);
-		}
+		toMat(object)->cleanUp();
 	}
 
 	static void setValue22(void *object, double value)
 	{
 		toMat(object)->_mat.vals[4] = value;
-		if (*toMat(object)->_clean)
-		{
-			(*toMat(object)->_clean)(toMat(object)->_parent);
-		}
+		toMat(object)->cleanUp();
 	}
 
 	static void setValue23(void *object, double value)
 	{
 		toMat(object)->_mat.vals[5] = value;
-		if (*toMat(object)->_clean)
-		{
-			(*toMat(object)->_clean)(toMat(object)->_parent);
-		}
+		toMat(object)->cleanUp();
 	}
 
 	static void setValue31(void *object, double value)
 	{
 		toMat(object)->_mat.vals[6] = value;
-		if (*toMat(object)->_clean)
-		{
-			(*toMat(object)->_clean)(toMat(object)->_parent);
-		}
+		toMat(object)->cleanUp();
 	}
 
 	static void setValue32(void *object, double value)
 	{
 		toMat(object)->_mat.vals[7] = value;
-		if (*toMat(object)->_clean)
-		{
-			(*toMat(object)->_clean)(toMat(object)->_parent);
-		}
+		toMat(object)->cleanUp();
 	}
 
 	static void setValue33(void *object, double value)
 	{
 		toMat(object)->_mat.vals[8] = value;
-		if (*toMat(object)->_clean)
+		toMat(object)->cleanUp();
+	}
+
+	/* t11, t22, t33 and then, for six values, t12, t13 and t23: the
+	 * order of addMajorAxesToStrategy and addTensorToStrategy */
+	static void setTensorBlock(void *object, const double *vals, size_t n)
+	{
+		static const int diag[] = {0, 4, 8};
+		static const int upper[] = {1, 2, 5};
+		static const int lower[] = {3, 6, 7};
+		mat3x3 &mat = toMat(object)->_mat;
+
+		for (size_t i = 0; i < n && i < 3; i++)
+		{
+			mat.vals[diag[i]] = vals[i];
+		}
+
+		for (size_t i = 3; i < n && i < 6; i++)
 		{
-			(*toMat(object)->_clean)(toMat(object)->_parent);
+			mat.vals[upper[i - 3]] = vals[i];
+			mat.vals[lower[i - 3]] = vals[i];
 		}
+
+		toMat(object)->cleanUp();
+	}
+
+	/* all nine values in the order of addMatrixToStrategy */
+	static void setMatrixBlock(void *object, const double *vals, size_t n)
+	{
+		mat3x3 &mat = toMat(object)->_mat;
+
+		for (size_t i = 0; i < n && i < 9; i++)
+		{
+			mat.vals[i] = vals[i];
+		}
+
+		toMat(object)->cleanUp();
 	}
 
 	static double getTensor11(void *object)
@@ -327,7 +315,7 @@ public:
 		                       tol, prefix + "_t22");
 		strategy->addParameter(this, getTensor33, setTensor33, step,
 		                       tol, prefix + "_t33");
-
+		strategy->setBlockSetter(3, setTensorBlock);
 	}
 
 	void addTensorToStrategy(RefinementStrategyPtr strategy, double step,
@@ -345,6 +333,7 @@ public:
 		                       tol, prefix + "_t13");
 		strategy->addParameter(this, getTensor23, setTensor23, step,
 		                       tol, prefix + "_t23");
+		strategy->setBlockSetter(6, setTensorBlock);
 	}
 	
 	void addMatrixToStrategy(RefinementStrategyPtr strategy, double step,
@@ -368,13 +357,26 @@ public:
 		                       tol, prefix + "_t32");
 		strategy->addParameter(this, getValue33, setValue33, step,
 		                       tol, prefix + "_t33");
-
+		strategy->setBlockSetter(9, setMatrixBlock);
 	}
 	
 private:
+	void cleanUp()
+	{
+		if (_clean && _queue)
+		{
+			_queue->mark(_clean, _parent);
+		}
+		else if (_clean)
+		{
+			(*_clean)(_parent);
+		}
+	}
+
 	mat3x3 _mat;
 	void *_parent;
 	CleanUp _clean;
+	RefreshQueue *_queue;
 };
 
 #endif
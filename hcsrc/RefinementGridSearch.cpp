@@ -18,135 +18,599 @@
 
 #include "RefinementGridSearch.h"
 #include <float.h>
+#include <stdint.h>
+#include <cmath>
+#include <algorithm>
 #include <iostream>
 #include <iomanip>
 #include "FileReader.h"
-
-int RefinementGridSearch::_refine_counter = 0;
+#include "Checkpoint.h"
 
 double RefinementGridSearch::getGridLength(size_t which)
 {	
-	Parameter *param = &_params[which];
-	double grid_length = param->step_size / param->other_value;
+	double grid_length = _params.stepSize(which) / _params.otherValue(which);
 	return grid_length;
 }
 
-void RefinementGridSearch::recursiveEvaluation(ParamList referenceList, ParamList workingList, ResultMap *results)
+void RefinementGridSearch::setupGrid(const ParamList &centre)
 {
 	size_t paramCount = parameterCount();
-	size_t workingCount = workingList.size();
+	_gridCentre = centre;
+	_gridStart.resize(paramCount);
+	_gridCount.resize(paramCount);
+	_gridTotal = 1;
+
+	for (size_t i = 0; i < paramCount; i++)
+	{
+		double grid_length = getGridLength(i);
+		int start = -grid_length / 2;
+		int end = (int)(grid_length / 2 + 0.5);
+		
+		_gridStart[i] = start;
+		_gridCount[i] = (end >= start ? end - start + 1 : 0);
+		_gridTotal *= _gridCount[i];
+	}
+}
+
+void RefinementGridSearch::pointForIndex(size_t idx, double *vals)
+{
+	for (int i = (int)parameterCount() - 1; i >= 0; i--)
+	{
+		size_t which = idx % _gridCount[i];
+		idx /= _gridCount[i];
+
+		/* in refinement grid, step is actually limit... oops */
+		double step = _params.otherValue(i);
+		vals[i] = _gridCentre[i] + (_gridStart[i] + (int)which) * step;
+	}
+}
+
+ParamList RefinementGridSearch::paramsForIndex(size_t idx)
+{
+	ParamList point(parameterCount());
+	pointForIndex(idx, &point[0]);
+	return point;
+}
+
+void RefinementGridSearch::storeResults(size_t start, size_t count, 
+                                        const double *scores)
+{
+	ParamList point(parameterCount());
 
-	if (workingCount < paramCount)
+	for (size_t i = 0; i < count; i++)
 	{
-		Parameter *param = &_params[workingCount];
-		double grid_length = getGridLength(workingCount);
+		double result = scores[i];
+		pointForIndex(start + i, &point[0]);
 
-		for (int i = -grid_length / 2; i <= (int)(grid_length / 2 + 0.5); i++)
+		results[point] = result;
+		reverseResults[result] = point;
+		orderedParams.push_back(point);
+		
+		if (parameterCount() == 2)
 		{
-			double mean = referenceList[workingCount];
-			/* in refinement grid, step is actually limit... oops */
-			double step = param->other_value;
-			double value = mean + i * step;
+			_array2D.push_back(result);
+		}
+	}
+}
 
-			ParamList extended = workingList;
-			extended.push_back(value);
-			recursiveEvaluation(referenceList, extended, results);
+void RefinementGridSearch::writeToSink(size_t start, size_t count,
+                                       const double *scores)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		if (_binarySink)
+		{
+			uint64_t idx = start + i;
+			_sink->write((const char *)&idx, sizeof(uint64_t));
+			_sink->write((const char *)&scores[i], sizeof(double));
 		}
+		else
+		{
+			*_sink << start + i << "," << std::setprecision(10) 
+			<< scores[i] << "\n";
+		}
+	}
+}
 
-		return;
+/* failed points come back from batch backends as NaN; ordering them
+ * last keeps them from winning and keeps every comparison well defined */
+static double orderedScore(double score)
+{
+	return (std::isfinite(score) ? score : INFINITY);
+}
+
+void RefinementGridSearch::consumeScore(size_t idx, double score)
+{
+	bool finite = std::isfinite(score);
+	score = orderedScore(score);
+	GridResult result = std::make_pair(score, idx);
+	GridResult best = std::make_pair(_minScore, _minIndex);
+
+	/* lower index wins ties, exactly as the serial walk would */
+	if (_evaluations == 0 || result < best)
+	{
+		_minScore = score;
+		_minIndex = idx;
 	}
 
-	for (int i = 0; i < workingList.size(); i++)
+	/* failed points are no result worth keeping */
+	if (_keepBest > 0 && finite)
 	{
-		setValueForParam(i, workingList[i]);
+		if (_bestHeap.size() < _keepBest)
+		{
+			_bestHeap.push_back(result);
+			std::push_heap(_bestHeap.begin(), _bestHeap.end());
+		}
+		else if (result < _bestHeap.front())
+		{
+			std::pop_heap(_bestHeap.begin(), _bestHeap.end());
+			_bestHeap.back() = result;
+			std::push_heap(_bestHeap.begin(), _bestHeap.end());
+		}
 	}
 
-	double result = (*evaluationFunction)(evaluateObject);
-	(*results)[workingList] = result;
-	reverseResults[result] = workingList;
+	_evaluations++;
+	reportProgress(score);
+}
 
-	orderedParams.push_back(workingList);
-	orderedResults.push_back(result);
-	
-	if (parameterCount() == 2)
+void RefinementGridSearch::consumeBlock(size_t start, size_t count, 
+                                        const double *scores)
+{
+	for (size_t i = 0; i < count; i++)
 	{
-		_array2D.push_back(result);
+		consumeScore(start + i, scores[i]);
 	}
 
-	reportProgress(result);
+	if (_sink)
+	{
+		writeToSink(start, count, scores);
+	}
+
+	if (_storage == GridStorageAll)
+	{
+		storeResults(start, count, scores);
+	}
 }
 
-void RefinementGridSearch::refine()
+std::vector<GridResult> RefinementGridSearch::bestResults()
 {
-	RefinementStrategy::refine();
+	std::vector<GridResult> best = _bestHeap;
+	std::sort_heap(best.begin(), best.end());
+	return best;
+}
 
-	ParamList currentValues;
+void RefinementGridSearch::exhaustive()
+{
+	size_t offset = orderedResults.size();
+	bool keepScores = (_storage != GridStorageNone);
+	std::vector<double> block;
+	_gridOffset = offset;
 
-	for (int i = 0; i < parameterCount(); i++)
+	if (keepScores)
 	{
-		double val = getValueForParam(i);
-		currentValues.push_back(val);
+		orderedResults.resize(offset + _gridTotal);
+		std::copy(_restoredScores.begin(), _restoredScores.end(),
+		          orderedResults.begin() + offset);
+	}
+	else
+	{
+		block.resize(std::min(_blockSize, _gridTotal));
 	}
 
-	if (parameterCount() == 2)
+	if (_storage == GridStorageAll && _restoredScores.size())
 	{
-		double grid_area = getGridLength(0);
-		grid_area *= getGridLength(1);
+		storeResults(0, _restoredScores.size(), &_restoredScores[0]);
+	}
+
+	_restoredScores.clear();
+
+	for (size_t start = _cursor; start < _gridTotal; start += _blockSize)
+	{
+		size_t count = std::min(_blockSize, _gridTotal - start);
+		double *scores = (keepScores ? orderedResults.data() + offset + start
+		                  : block.data());
+
+		evaluateIndexed(count, [this, start](size_t idx, double *vals)
+		{
+			pointForIndex(start + idx, vals);
+		}, scores);
 
-		_array2D.reserve(grid_area);
+		consumeBlock(start, count, scores);
+		_cursor = start + count;
+		checkpoint();
 	}
+}
 
-	recursiveEvaluation(currentValues, ParamList(), &results);
+void RefinementGridSearch::evaluateIndices(std::vector<size_t> &indices,
+                                           ScoreMap *visited,
+                                           std::vector<GridResult> *level)
+{
+	std::sort(indices.begin(), indices.end());
+	indices.erase(std::unique(indices.begin(), indices.end()), indices.end());
 
-	double minResult = (*evaluationFunction)(evaluateObject);
-	ParamList minParams;
-	bool changed = false;
+	std::vector<size_t> todo;
+	for (size_t i = 0; i < indices.size(); i++)
+	{
+		ScoreMap::iterator it = visited->find(indices[i]);
 
-	for (ResultMap::iterator it = results.begin(); it != results.end(); it++)
+		if (it == visited->end())
+		{
+			todo.push_back(indices[i]);
+		}
+		else
+		{
+			level->push_back(std::make_pair(it->second, it->first));
+		}
+	}
+
+	std::vector<double> scores(todo.size());
+
+	for (size_t start = 0; start < todo.size(); start += _blockSize)
 	{
-		if (it->second < minResult)
+		size_t count = std::min(_blockSize, todo.size() - start);
+
+		evaluateIndexed(count, [this, &todo, start](size_t idx, double *vals)
+		{
+			pointForIndex(todo[start + idx], vals);
+		}, scores.data() + start);
+
+		for (size_t i = start; i < start + count; i++)
 		{
-			minResult = it->second;
-			minParams = it->first;
-			changed = true;
+			size_t idx = todo[i];
+			(*visited)[idx] = orderedScore(scores[i]);
+			level->push_back(std::make_pair(orderedScore(scores[i]), idx));
+			consumeScore(idx, scores[i]);
+
+			if (_sink)
+			{
+				writeToSink(idx, 1, &scores[i]);
+			}
+
+			if (_storage == GridStorageAll)
+			{
+				results[paramsForIndex(idx)] = scores[i];
+			}
 		}
 
-		std::vector<double> result = it->first;
-		
-		for (int i = 0; i < result.size(); i++)
+		checkpoint();
+	}
+}
+
+size_t RefinementGridSearch::indexForCoords(const std::vector<long> &coords)
+{
+	size_t idx = 0;
+
+	for (size_t i = 0; i < coords.size(); i++)
+	{
+		idx = idx * _gridCount[i] + coords[i];
+	}
+	
+	return idx;
+}
+
+void RefinementGridSearch::addNeighbourhood(size_t centre, 
+                                            const std::vector<long> &stride,
+                                            const std::vector<long> &span,
+                                            std::vector<size_t> *indices)
+{
+	size_t n = parameterCount();
+	std::vector<long> middle(n);
+	std::vector<long> coords(n);
+	
+	for (int i = (int)n - 1; i >= 0; i--)
+	{
+		middle[i] = centre % _gridCount[i];
+		centre /= _gridCount[i];
+	}
+
+	/* odometer over offsets of -span to +span in steps of stride */
+	std::vector<long> offset(n);
+	for (size_t i = 0; i < n; i++)
+	{
+		offset[i] = -span[i];
+	}
+
+	while (true)
+	{
+		bool inside = true;
+		for (size_t i = 0; i < n && inside; i++)
 		{
-			result[i] *= degMult();
+			coords[i] = middle[i] + offset[i];
+			inside = (coords[i] >= 0 && coords[i] < (long)_gridCount[i]);
+		}
+
+		if (inside)
+		{
+			indices->push_back(indexForCoords(coords));
+		}
+
+		int i = (int)n - 1;
+		for (; i >= 0; i--)
+		{
+			offset[i] += stride[i];
+			if (offset[i] <= span[i])
+			{
+				break;
+			}
+
+			offset[i] = -span[i];
+		}
+
+		if (i < 0)
+		{
+			break;
 		}
-		
-		result.push_back(it->second);
+	}
+}
+
+void RefinementGridSearch::coarseToFine()
+{
+	size_t n = parameterCount();
+	if (_gridTotal == 0)
+	{
+		return;
+	}
+
+	size_t longest = 1;
+	for (size_t i = 0; i < n; i++)
+	{
+		longest = std::max(longest, _gridCount[i]);
 	}
 
-	for (int i = 0; i < minParams.size(); i++)
+	/* start with no more than about eight points along the longest axis,
+	 * and at least three along the others where they have them */
+	long coarse = 1;
+	while (coarse * 8 < (long)longest)
 	{
-		double value = currentValues[i];
+		coarse *= 2;
+	}
+
+	std::vector<long> stride(n);
+	for (size_t i = 0; i < n; i++)
+	{
+		stride[i] = coarse;
+		while (stride[i] > 1 && stride[i] * 2 >= (long)_gridCount[i])
+		{
+			stride[i] /= 2;
+		}
+	}
+
+	ScoreMap &visited = _visited;
+	std::vector<GridResult> level;
+	std::vector<size_t> indices;
+
+	/* whole grid at the coarse stride: a neighbourhood spanning
+	 * everything from the first grid point */
+	std::vector<long> span(n);
+	for (size_t i = 0; i < n; i++)
+	{
+		span[i] = (_gridCount[i] / stride[i]) * stride[i];
+	}
+
+	addNeighbourhood(0, stride, span, &indices);
+	evaluateIndices(indices, &visited, &level);
+
+	while (true)
+	{
+		bool finest = true;
+		for (size_t i = 0; i < n; i++)
+		{
+			finest &= (stride[i] == 1);
+		}
+
+		/* choose the best cells of this level to look into */
+		std::sort(level.begin(), level.end());
+		if (level.size() > _coarseTop)
+		{
+			level.resize(_coarseTop);
+		}
 
-		if (!_mock && changed)
+		if (_pruneMargin >= 0)
 		{
-			value = minParams[i];
+			size_t keep = 0;
+			while (keep < level.size() && 
+			       level[keep].first <= _minScore + _pruneMargin)
+			{
+				keep++;
+			}
+
+			level.resize(std::max(keep, (size_t)1));
+		}
+
+		/* halve the stride, looking as far as the old stride reached */
+		for (size_t i = 0; i < n; i++)
+		{
+			span[i] = stride[i];
+			stride[i] = std::max(stride[i] / 2, 1L);
+		}
+
+		indices.clear();
+		for (size_t j = 0; j < level.size(); j++)
+		{
+			addNeighbourhood(level[j].second, stride, span, &indices);
 		}
 
-		setValueForParam(i, value);
+		level.clear();
+		evaluateIndices(indices, &visited, &level);
+
+		if (finest)
+		{
+			break;
+		}
+	}
+}
+
+void RefinementGridSearch::writeState(std::ostream &out)
+{
+	std::vector<double> heapScores;
+	std::vector<uint64_t> heapIndices;
+
+	for (size_t i = 0; i < _bestHeap.size(); i++)
+	{
+		heapScores.push_back(_bestHeap[i].first);
+		heapIndices.push_back(_bestHeap[i].second);
+	}
+
+	writeBinary(out, (uint64_t)_gridTotal);
+	writeBinary(out, (uint64_t)_evaluations);
+	writeBinary(out, (uint64_t)_minIndex);
+	writeBinary(out, _minScore);
+	writeBinaryVector(out, heapScores);
+	writeBinaryVector(out, heapIndices);
+	writeBinary(out, (uint64_t)_cursor);
+
+	std::vector<double> scores;
+	if (_storage != GridStorageNone && _coarseTop == 0)
+	{
+		scores.assign(orderedResults.begin() + _gridOffset,
+		              orderedResults.begin() + _gridOffset + _cursor);
+	}
+
+	writeBinaryVector(out, scores);
+
+	std::vector<uint64_t> visitedIndices;
+	std::vector<double> visitedScores;
+
+	for (ScoreMap::iterator it = _visited.begin(); it != _visited.end(); it++)
+	{
+		visitedIndices.push_back(it->first);
+		visitedScores.push_back(it->second);
+	}
+
+	writeBinaryVector(out, visitedIndices);
+	writeBinaryVector(out, visitedScores);
+}
+
+bool RefinementGridSearch::readState(std::istream &in)
+{
+	uint64_t total = 0;
+	uint64_t evaluations = 0;
+	uint64_t minIndex = 0;
+	uint64_t cursor = 0;
+	double minScore = 0;
+	std::vector<double> heapScores, scores, visitedScores;
+	std::vector<uint64_t> heapIndices, visitedIndices;
+
+	if (!(readBinary(in, total) && readBinary(in, evaluations) &&
+	      readBinary(in, minIndex) && readBinary(in, minScore) &&
+	      readBinaryVector(in, heapScores) && 
+	      readBinaryVector(in, heapIndices) &&
+	      readBinary(in, cursor) && readBinaryVector(in, scores) &&
+	      readBinaryVector(in, visitedIndices) &&
+	      readBinaryVector(in, visitedScores)))
+	{
+		return false;
+	}
+
+	/* the grid or the mode of searching it has changed */
+	bool keepScores = (_storage != GridStorageNone && _coarseTop == 0);
+	if (total != _gridTotal || cursor > total ||
+	    heapScores.size() != heapIndices.size() ||
+	    visitedScores.size() != visitedIndices.size() ||
+	    (keepScores && scores.size() != cursor) ||
+	    (_coarseTop == 0) != (visitedIndices.size() == 0))
+	{
+		return false;
+	}
+
+	_evaluations = evaluations;
+	_minIndex = minIndex;
+	_minScore = minScore;
+	_cursor = cursor;
+	_restoredScores = scores;
+
+	_bestHeap.clear();
+	for (size_t i = 0; i < heapScores.size(); i++)
+	{
+		_bestHeap.push_back(std::make_pair(heapScores[i], heapIndices[i]));
+	}
+
+	std::make_heap(_bestHeap.begin(), _bestHeap.end());
+
+	for (size_t i = 0; i < visitedIndices.size(); i++)
+	{
+		_visited[visitedIndices[i]] = visitedScores[i];
+	}
+
+	return true;
+}
+
+void RefinementGridSearch::refine()
+{
+	RefinementStrategy::refine();
+
+	ParamList currentValues;
+
+	for (int i = 0; i < parameterCount(); i++)
+	{
+		double val = getValueForParam(i);
+		currentValues.push_back(val);
+	}
+
+	setupGrid(currentValues);
+
+	if (parameterCount() == 2 && _storage == GridStorageAll)
+	{
+		_array2D.reserve(_array2D.size() + _gridTotal);
+	}
+
+	_bestHeap.clear();
+	_evaluations = 0;
+	_minIndex = 0;
+	_minScore = 0;
+	_cursor = 0;
+	_visited.clear();
+	_restoredScores.clear();
+	resumeState();
+
+	if (_sink && !_binarySink)
+	{
+		*_sink << "index,score" << std::endl;
+	}
+
+	if (_coarseTop > 0)
+	{
+		coarseToFine();
 	}
+	else
+	{
+		exhaustive();
+	}
+
+	if (_sink)
+	{
+		_sink->flush();
+	}
+
+	ParamList minParams(parameterCount());
+	bool changed = (_evaluations > 0);
+
+	if (changed)
+	{
+		pointForIndex(_minIndex, &minParams[0]);
+	}
+
+	if (_mock || !changed)
+	{
+		minParams = currentValues;
+	}
+
+	setValuesForParams(&minParams[0]);
 
 	if (parameterCount() == 2 && _writePNG)
 	{
-		int stride = _params[0].step_size / _params[0].other_value;
+		int stride = _params.stepSize(0) / _params.otherValue(0);
 
 		std::map<std::string, std::string> plotMap;
 		plotMap["filename"] = jobName + "_gridsearch_" + i_to_str(_refine_counter);
 		plotMap["height"] = "800";
 		plotMap["width"] = "800";
-		plotMap["xHeader0"] = _params[0].tag;
-		plotMap["yHeader0"] = _params[1].tag;
+		plotMap["xHeader0"] = _params.tag(0);
+		plotMap["yHeader0"] = _params.tag(1);
 		plotMap["zHeader0"] = "result";
 
-		plotMap["xTitle0"] = _params[0].tag;
-		plotMap["yTitle0"] = _params[1].tag;
+		plotMap["xTitle0"] = _params.tag(0);
+		plotMap["yTitle0"] = _params.tag(1);
 		plotMap["style0"] = "heatmap";
 		plotMap["stride"] = i_to_str(stride);
 	}
@@ -27,6 +27,17 @@ typedef std::vector<double> ParamList;
 typedef std::map<ParamList, double> ResultMap;
 typedef std::map<double, ParamList> ReverseMap;
 
+/* score and grid index of one evaluated point */
+typedef std::pair<double, size_t> GridResult;
+typedef std::map<size_t, double> ScoreMap;
+
+typedef enum
+{
+	GridStorageAll = 0, /* results, orderedParams etc. as well as scores */
+	GridStorageScores = 1, /* only orderedResults, by grid index */
+	GridStorageNone = 2, /* nothing per point: use keepBest or a sink */
+} GridStorage;
+
 class RefinementGridSearch : public RefinementStrategy
 {
 private:
@@ -37,19 +48,78 @@ private:
 	ReverseMap reverseResults;
 	std::vector<double> orderedResults;
 	std::vector<ParamList> orderedParams;
-	static int _refine_counter; /* thread care! */
+	int _refine_counter;
 	std::vector<double> _array2D;
 
+	/* grid layout: the last parameter varies fastest */
+	std::vector<double> _gridCentre;
+	std::vector<int> _gridStart;
+	std::vector<size_t> _gridCount;
+	size_t _gridTotal;
+
+	GridStorage _storage;
+	size_t _blockSize;
+	size_t _keepBest;
+	std::vector<GridResult> _bestHeap;
+	std::ostream *_sink;
+	bool _binarySink;
+
+	size_t _minIndex;
+	double _minScore;
+	size_t _evaluations;
+
+	size_t _coarseTop;
+	double _pruneMargin;
+
+	/* progress of the current refine(), for checkpoints: the start of
+	 * the next block of the exhaustive search, with scores from
+	 * _gridOffset in orderedResults, or the points visited so far by
+	 * the coarse-to-fine search */
+	size_t _cursor;
+	size_t _gridOffset;
+	std::vector<double> _restoredScores;
+	ScoreMap _visited;
+
 	double getGridLength(size_t which);
+	void setupGrid(const ParamList &centre);
+	void storeResults(size_t start, size_t count, const double *scores);
+	void consumeScore(size_t idx, double score);
+	void consumeBlock(size_t start, size_t count, const double *scores);
+	void exhaustive();
+	void coarseToFine();
+	void evaluateIndices(std::vector<size_t> &indices, ScoreMap *visited,
+	                     std::vector<GridResult> *level);
+	size_t indexForCoords(const std::vector<long> &coords);
+	void addNeighbourhood(size_t centre, const std::vector<long> &stride,
+	                      const std::vector<long> &span,
+	                      std::vector<size_t> *indices);
+	void writeToSink(size_t start, size_t count, const double *scores);
+
+	virtual void writeState(std::ostream &out);
+	virtual bool readState(std::istream &in);
 
 public:
 	RefinementGridSearch() : RefinementStrategy()
 	{
 		gridJumps = 8;
+		_refine_counter = 0;
 		gridLength = 15;
 		cycleNum = 1;
 		_writeCSV = false;
 		_writePNG = false;
+		_gridTotal = 0;
+		_storage = GridStorageAll;
+		_blockSize = 65536;
+		_keepBest = 0;
+		_sink = NULL;
+		_binarySink = false;
+		_minIndex = 0;
+		_minScore = 0;
+		_evaluations = 0;
+		_coarseTop = 0;
+		_pruneMargin = -1;
+		_cursor = 0;
+		_gridOffset = 0;
 	};
 
 	void setGridLength(int length)
@@ -74,11 +144,77 @@ public:
 	
 	std::vector<double> array2D()
 	{
+		if (_storage == GridStorageScores)
+		{
+			return orderedResults;
+		}
+
 		return _array2D;
 	}
+	
+	/* GridStorageAll keeps every point several times over for the
+	 * benefit of results; the leaner modes are for very large grids. */
+	void setStorage(GridStorage storage)
+	{
+		_storage = storage;
+	}
+	
+	/* number of grid points evaluated before their scores are handed
+	 * on; this bounds memory use when nothing is stored */
+	void setBlockSize(size_t size)
+	{
+		_blockSize = (size > 0 ? size : 1);
+	}
+	
+	/* retain the best K points of the latest refine() in a heap */
+	void setKeepBest(size_t k)
+	{
+		_keepBest = k;
+	}
+
+	/* best points of the latest refine(), best first; decode the
+	 * indices with paramsForIndex() */
+	std::vector<GridResult> bestResults();
+	
+	/* each (index, score) pair is written to the stream as it is
+	 * computed, either as CSV lines or as a binary uint64 index followed
+	 * by a double score. */
+	void setResultSink(std::ostream *sink, bool binary = false)
+	{
+		_sink = sink;
+		_binarySink = binary;
+	}
+	
+	size_t gridPointCount()
+	{
+		return _gridTotal;
+	}
+	
+	/* number of grid points scored by the latest refine() */
+	size_t gridEvaluations()
+	{
+		return _evaluations;
+	}
+	
+	/* Instead of the whole grid, search it at a coarse stride first, then
+	 * repeatedly take the best topCells points and search around them at
+	 * half the stride until the grid spacing (other_value) is reached.
+	 * With a margin of zero or more, cells scoring worse than the best
+	 * point so far by more than the margin are dropped at each level.
+	 * Only results, the best-K heap and the sink are filled in this mode.
+	 * Zero topCells returns to the exhaustive search. 
+	 * When resuming from a checkpoint, points scored before it are not
+	 * given to results or the sink again, in either mode. */
+	void setCoarseToFine(size_t topCells, double pruneMargin = -1)
+	{
+		_coarseTop = topCells;
+		_pruneMargin = pruneMargin;
+	}
+
+	ParamList paramsForIndex(size_t idx);
+	void pointForIndex(size_t idx, double *vals);
 
 	ResultMap results;
-	void recursiveEvaluation(ParamList referenceList, ParamList workingList, ResultMap *results);
 
 	virtual void clearParameters()
 	{
@@ -20,11 +20,176 @@
 #include "RefinementLBFGS.h"
 #include <iostream>
 #include <iomanip>
+#include <algorithm>
+#include "Checkpoint.h"
+
+/* elements per chunk of a vector operation; fixed so that sums are
+ * reduced in the same order whatever the number of threads */
+#define VECTOR_CHUNK 16384
 
 RefinementLBFGS::RefinementLBFGS()
 {
 	_fx = 0;
 	_func = NULL;
+	_vectorGrad = NULL;
+	_vectorObj = NULL;
+	_history = 6;
+	_maxIterations = 10;
+	_lineSteps = 0;
+	_doneIterations = 0;
+	_iteration = 0;
+	_progressX = NULL;
+
+	_ops.instance = this;
+	_ops.dot = vectorDot;
+	_ops.cpy = vectorCopy;
+	_ops.ncpy = vectorNegCopy;
+	_ops.add = vectorAdd;
+	_ops.diff = vectorDiff;
+	_ops.scale = vectorScale;
+}
+
+void RefinementLBFGS::setVectorThreads(int threads)
+{
+	if (threads <= 0)
+	{
+		threads = ThreadPool::hardwareThreads();
+	}
+
+	_vectorPool = boost::shared_ptr<ThreadPool>();
+
+	if (threads > 1)
+	{
+		_vectorPool = boost::shared_ptr<ThreadPool>(new ThreadPool(threads));
+	}
+}
+
+size_t RefinementLBFGS::historyPairBytes()
+{
+	return lbfgs_history_pair_size(parameterCount());
+}
+
+size_t RefinementLBFGS::memoryBytes()
+{
+	size_t vector = lbfgs_padded_length(parameterCount());
+	vector *= sizeof(lbfgsfloatval_t);
+
+	/* xp, g, gp, d, w and our own x and g */
+	return _history * historyPairBytes() + 7 * vector;
+}
+
+void RefinementLBFGS::runChunks(int n, const ChunkJob &job)
+{
+	size_t chunks = (n + VECTOR_CHUNK - 1) / VECTOR_CHUNK;
+	
+	if (chunks <= 1 || !_vectorPool)
+	{
+		for (size_t i = 0; i < chunks; i++)
+		{
+			size_t end = std::min((size_t)n, (i + 1) * VECTOR_CHUNK);
+			job(i * VECTOR_CHUNK, end, i);
+		}
+
+		return;
+	}
+
+	_vectorPool->run(chunks, [&](size_t i, int)
+	{
+		size_t end = std::min((size_t)n, (i + 1) * VECTOR_CHUNK);
+		job(i * VECTOR_CHUNK, end, i);
+	});
+}
+
+void RefinementLBFGS::vectorDot(void *instance, lbfgsfloatval_t *s,
+                                const lbfgsfloatval_t *x, 
+                                const lbfgsfloatval_t *y, const int n)
+{
+	RefinementLBFGS *me = static_cast<RefinementLBFGS *>(instance);
+	std::vector<double> &partials = me->_partials;
+	partials.resize((n + VECTOR_CHUNK - 1) / VECTOR_CHUNK);
+
+	me->runChunks(n, [&](size_t start, size_t end, size_t chunk)
+	{
+		double sum = 0;
+		for (size_t i = start; i < end; i++)
+		{
+			sum += x[i] * y[i];
+		}
+
+		partials[chunk] = sum;
+	});
+
+	double total = 0;
+	for (size_t i = 0; i < partials.size(); i++)
+	{
+		total += partials[i];
+	}
+
+	*s = total;
+}
+
+void RefinementLBFGS::vectorCopy(void *instance, lbfgsfloatval_t *y,
+                                 const lbfgsfloatval_t *x, const int n)
+{
+	RefinementLBFGS *me = static_cast<RefinementLBFGS *>(instance);
+	me->runChunks(n, [&](size_t start, size_t end, size_t)
+	{
+		std::copy(x + start, x + end, y + start);
+	});
+}
+
+void RefinementLBFGS::vectorNegCopy(void *instance, lbfgsfloatval_t *y,
+                                    const lbfgsfloatval_t *x, const int n)
+{
+	RefinementLBFGS *me = static_cast<RefinementLBFGS *>(instance);
+	me->runChunks(n, [&](size_t start, size_t end, size_t)
+	{
+		for (size_t i = start; i < end; i++)
+		{
+			y[i] = -x[i];
+		}
+	});
+}
+
+void RefinementLBFGS::vectorAdd(void *instance, lbfgsfloatval_t *y,
+                                const lbfgsfloatval_t *x, 
+                                const lbfgsfloatval_t c, const int n)
+{
+	RefinementLBFGS *me = static_cast<RefinementLBFGS *>(instance);
+	me->runChunks(n, [&](size_t start, size_t end, size_t)
+	{
+		for (size_t i = start; i < end; i++)
+		{
+			y[i] += c * x[i];
+		}
+	});
+}
+
+void RefinementLBFGS::vectorDiff(void *instance, lbfgsfloatval_t *z,
+                                 const lbfgsfloatval_t *x, 
+                                 const lbfgsfloatval_t *y, const int n)
+{
+	RefinementLBFGS *me = static_cast<RefinementLBFGS *>(instance);
+	me->runChunks(n, [&](size_t start, size_t end, size_t)
+	{
+		for (size_t i = start; i < end; i++)
+		{
+			z[i] = x[i] - y[i];
+		}
+	});
+}
+
+void RefinementLBFGS::vectorScale(void *instance, lbfgsfloatval_t *y,
+                                  const lbfgsfloatval_t c, const int n)
+{
+	RefinementLBFGS *me = static_cast<RefinementLBFGS *>(instance);
+	me->runChunks(n, [&](size_t start, size_t end, size_t)
+	{
+		for (size_t i = start; i < end; i++)
+		{
+			y[i] *= c;
+		}
+	});
 }
 
 int RefinementLBFGS::progress( void *instance, const lbfgsfloatval_t *x,
@@ -32,6 +197,12 @@ int RefinementLBFGS::progress( void *instance, const lbfgsfloatval_t *x,
     const lbfgsfloatval_t xnorm, const lbfgsfloatval_t gnorm,
     const lbfgsfloatval_t step, int n, int k, int ls)
 {
+	RefinementLBFGS *me = static_cast<RefinementLBFGS *>(instance);
+	me->_iteration = me->_doneIterations + k;
+	me->_progressX = x;
+	me->checkpoint();
+	me->_progressX = NULL;
+
 	/*
     printf("Iteration %d:\n", k);
     printf("  fx = %f, x[0] = %f, x[1] = %f\n", fx, x[0], x[1]);
@@ -49,19 +220,41 @@ double RefinementLBFGS::evaluate(void *instance,
 {
 	RefinementLBFGS *me = static_cast<RefinementLBFGS *>(instance);
 
+	if (me->_vectorGrad)
+	{
+		// user code fills in g from x directly, no setters involved
+		double eval = (*me->_vectorGrad)(me->_vectorObj, x, g, n);
+		me->_evalCount++;
+		me->reportProgress(eval);
+		return eval;
+	}
+
 	// put the values of x into the setters.
 	me->copyOutValues(x);
 	
 	if (me->_func)
 	{
+		me->flushRefresh();
 		(*me->_func)(me->_gradObj);
 	}
 	
+	double eval = NAN;
+
+	if (me->_gradMode == GradientForward)
+	{
+		// forward differences reuse the score at x
+		eval = me->evaluateScore();
+	}
+
 	// compute new values of gradients
-	me->copyInGradientValues(g);
+	me->copyInGradientValues(g, eval);
 
 	// return a new fx evaluation.
-	double eval = me->evaluationFunction(me->evaluateObject);
+	if (eval != eval)
+	{
+		eval = me->evaluateScore();
+	}
+
 	me->reportProgress(eval);
 
 	/*
@@ -80,35 +273,93 @@ double RefinementLBFGS::evaluate(void *instance,
 	return eval;
 }
 
-void RefinementLBFGS::copyOutValues(const lbfgsfloatval_t *x)
+void RefinementLBFGS::batchEvaluate(void *instance, 
+                                    const lbfgsfloatval_t *xp,
+                                    const lbfgsfloatval_t *s, 
+                                    const lbfgsfloatval_t *steps,
+                                    lbfgsfloatval_t *fs, const int n, 
+                                    const int count)
 {
-	for (size_t i = 0; i < parameterCount(); i++)
+	RefinementLBFGS *me = static_cast<RefinementLBFGS *>(instance);
+
+	me->evaluateIndexed(count, [&](size_t idx, double *vals)
+	{
+		for (int i = 0; i < n; i++)
+		{
+			vals[i] = xp[i] + steps[idx] * s[i];
+		}
+	}, fs);
+}
+
+void RefinementLBFGS::writeState(std::ostream &out)
+{
+	std::vector<double> x(_progressX, _progressX + parameterCount());
+	std::string history;
+
+	if (_memory)
 	{
-		setValueForParam(i, x[i]);
+		history.resize(lbfgs_history_bytes(_memory.get()));
+		lbfgs_history_save(_memory.get(), &history[0]);
 	}
+
+	writeBinary(out, (int32_t)_iteration);
+	writeBinaryVector(out, x);
+	writeBinaryString(out, history);
 }
 
-void RefinementLBFGS::copyInStartValues()
+bool RefinementLBFGS::readState(std::istream &in)
 {
-	for (size_t i = 0; i < parameterCount(); i++)
+	int32_t iteration = 0;
+	std::vector<double> x;
+	std::string history;
+
+	if (!(readBinary(in, iteration) && readBinaryVector(in, x) &&
+	      readBinaryString(in, history) && x.size() == parameterCount()))
 	{
-		_xs[i] = getValueForParam(i);
+		return false;
 	}
+
+	if (!_memory)
+	{
+		_memory = boost::shared_ptr<lbfgs_history_t>(lbfgs_history_new(),
+		                                             lbfgs_history_free);
+	}
+
+	if (!_memory || lbfgs_history_load(_memory.get(), history.data(), 
+	                                   history.size()) != 0)
+	{
+		return false;
+	}
+
+	std::copy(x.begin(), x.end(), _xs.begin());
+	_doneIterations = iteration;
+
+	return true;
+}
+
+void RefinementLBFGS::copyOutValues(const lbfgsfloatval_t *x)
+{
+	setValuesForParams(x);
 }
 
-void RefinementLBFGS::copyInGradientValues(lbfgsfloatval_t *g)
+void RefinementLBFGS::copyInStartValues()
 {
 	for (size_t i = 0; i < parameterCount(); i++)
 	{
-		g[i] = getGradientForParam(i);
+		_xs[i] = getValueForParam(i);
 	}
 }
 
+void RefinementLBFGS::copyInGradientValues(lbfgsfloatval_t *g, double score)
+{
+	calculateGradients(g, score);
+}
+
 bool RefinementLBFGS::hasAllGradients()
 {
 	for (size_t i = 0; i < parameterCount(); i++)
 	{
-		if (_params[i].gradient == NULL)
+		if (_params.gradient(i) == NULL)
 		{
 			return false;
 		}
@@ -124,21 +375,66 @@ void RefinementLBFGS::refine()
 	
 	lbfgs_parameter_init(&param);
 	param.epsilon = 1e-14;
-	param.max_iterations = 10;
+	param.m = _history;
+	param.max_iterations = _maxIterations;
 	
 	int count = parameterCount();
 	
-	_xs.resize(count);
-	_gs.resize(count);
+	/* vectorised builds of lbfgs want the padding zeroed */
+	int padded = lbfgs_padded_length(count);
+	_xs.assign(padded, 0);
+	_gs.assign(padded, 0);
 	
 	copyInStartValues();
+	_doneIterations = 0;
+	bool resumed = resumeState();
+	
+	if (resumed && _maxIterations > 0)
+	{
+		param.max_iterations = std::max(1, _maxIterations - _doneIterations);
+	}
+	
+	if (_vectorPool)
+	{
+		param.vector_ops = &_ops;
+	}
+	
+	/* checkpoints need the pairs as well as warm starts */
+	if (_warm || checkpointing() || resumed)
+	{
+		if (!_memory)
+		{
+			_memory = boost::shared_ptr<lbfgs_history_t>(lbfgs_history_new(),
+			                                             lbfgs_history_free);
+		}
+
+		if (!_warmValid && !resumed && _memory)
+		{
+			lbfgs_history_clear(_memory.get());
+		}
 
+		param.history = _memory.get();
+	}
+	
+	if (_lineSteps > 1 && parallelEvaluation())
+	{
+		param.batch_evaluate = batchEvaluate;
+		param.batch_steps = _lineSteps;
+		param.linesearch = LBFGS_LINESEARCH_BACKTRACKING_STRONG_WOLFE;
+	}
+	
 	if (_func == NULL && hasAllGradients())
 	{
-		std::cout << "Yelp!" << std::endl;
+		*_stream << "Yelp!" << std::endl;
 	}
 	
 	lbfgs(count, &_xs[0], &_fx, evaluate, progress, this, &param);
 
+	if (_vectorGrad)
+	{
+		// the model has not seen x yet
+		copyOutValues(&_xs[0]);
+	}
+
 	finish();
 }
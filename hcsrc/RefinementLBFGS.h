@@ -20,10 +20,59 @@
 #ifndef __vagabond__RefinementLBFGS__
 #define __vagabond__RefinementLBFGS__
 
+#include <new>
 #include "lbfgs.h"
+#include "ThreadPool.h"
 #include "RefinementStrategy.h"
 
-typedef std::vector<lbfgsfloatval_t> LbfgsVector;
+/* keeps vectors handed to lbfgs() aligned for its SSE/AVX routines */
+template <class T>
+struct LbfgsAllocator
+{
+	typedef T value_type;
+
+	LbfgsAllocator() {}
+
+	template <class U>
+	LbfgsAllocator(const LbfgsAllocator<U> &) {}
+
+	T *allocate(size_t n)
+	{
+		size_t size = sizeof(lbfgsfloatval_t);
+		void *ptr = lbfgs_malloc((n * sizeof(T) + size - 1) / size);
+
+		if (ptr == NULL)
+		{
+			throw std::bad_alloc();
+		}
+
+		return static_cast<T *>(ptr);
+	}
+
+	void deallocate(T *ptr, size_t)
+	{
+		lbfgs_free((lbfgsfloatval_t *)ptr);
+	}
+};
+
+template <class T, class U>
+bool operator==(const LbfgsAllocator<T> &, const LbfgsAllocator<U> &)
+{
+	return true;
+}
+
+template <class T, class U>
+bool operator!=(const LbfgsAllocator<T> &, const LbfgsAllocator<U> &)
+{
+	return false;
+}
+
+typedef std::vector<lbfgsfloatval_t, 
+                    LbfgsAllocator<lbfgsfloatval_t> > LbfgsVector;
+
+/* fills in the n gradients g at parameter values x and returns the score */
+typedef double (*VectorGradient)(void *object, const double *x, double *g,
+                                 int n);
 
 class RefinementLBFGS : public RefinementStrategy
 {
@@ -36,9 +85,72 @@ public:
 		_func = func;
 	}
 	
+	/* score and whole gradient from one call on the parameter array,
+	 * instead of the setters, gradient getters and evaluation function.
+	 * Values are put through the setters once refinement has finished;
+	 * the evaluation function is still used for the start and end scores.
+	 * DualGradient (Dual.h) provides one for any generic objective. */
+	void setVectorGradient(VectorGradient func, void *object)
+	{
+		_vectorGrad = func;
+		_vectorObj = object;
+	}
+	
+	/* number of correction pairs kept by lbfgs, default 6 */
+	void setHistorySize(int history)
+	{
+		_history = history;
+	}
+	
+	/* default 10; 0 carries on until convergence */
+	void setMaxIterations(int iterations)
+	{
+		_maxIterations = iterations;
+	}
+	
+	/* spreads the vector operations of lbfgs over this many threads
+	 * (0 for all hardware threads), for very many parameters.
+	 * Sums are reduced in a fixed order whatever the thread count. */
+	void setVectorThreads(int threads);
+	
+	/* with clone functions set and more than one thread, the line
+	 * search scores this many step lengths at once on the clones.
+	 * 0 or 1 keeps the serial More-Thuente line search. */
+	void setParallelLineSearch(int steps)
+	{
+		_lineSteps = steps;
+	}
+	
+	/* bytes taken by each correction pair for the current parameters */
+	size_t historyPairBytes();
+	
+	/* approximate bytes allocated by lbfgs for the current parameters,
+	 * including all correction pairs */
+	size_t memoryBytes();
+	
 	virtual void refine();
 private:
 	bool hasAllGradients();
+	
+	typedef std::function<void (size_t start, size_t end, 
+	                            size_t chunk)> ChunkJob;
+	void runChunks(int n, const ChunkJob &job);
+
+	static void vectorDot(void *instance, lbfgsfloatval_t *s,
+	                      const lbfgsfloatval_t *x, const lbfgsfloatval_t *y,
+	                      const int n);
+	static void vectorCopy(void *instance, lbfgsfloatval_t *y,
+	                       const lbfgsfloatval_t *x, const int n);
+	static void vectorNegCopy(void *instance, lbfgsfloatval_t *y,
+	                          const lbfgsfloatval_t *x, const int n);
+	static void vectorAdd(void *instance, lbfgsfloatval_t *y,
+	                      const lbfgsfloatval_t *x, const lbfgsfloatval_t c,
+	                      const int n);
+	static void vectorDiff(void *instance, lbfgsfloatval_t *z,
+	                       const lbfgsfloatval_t *x, const lbfgsfloatval_t *y,
+	                       const int n);
+	static void vectorScale(void *instance, lbfgsfloatval_t *y,
+	                        const lbfgsfloatval_t c, const int n);
 
 	static double evaluate(void *instance,
 	                       const lbfgsfloatval_t *x,
@@ -46,21 +158,48 @@ private:
 	                       const int n,
 	                       const lbfgsfloatval_t step);
 
+	static void batchEvaluate(void *instance, const lbfgsfloatval_t *xp,
+	                          const lbfgsfloatval_t *s, 
+	                          const lbfgsfloatval_t *steps,
+	                          lbfgsfloatval_t *fs, const int n, 
+	                          const int count);
+
 	static int progress( void *instance, const lbfgsfloatval_t *x,
 	                    const lbfgsfloatval_t *g, const lbfgsfloatval_t fx,
 	                    const lbfgsfloatval_t xnorm, 
 	                    const lbfgsfloatval_t gnorm,
 	                    const lbfgsfloatval_t step, int n, int k, int ls);
 
-	void copyInGradientValues(lbfgsfloatval_t *g);
+	virtual void writeState(std::ostream &out);
+	virtual bool readState(std::istream &in);
+
+	void copyInGradientValues(lbfgsfloatval_t *g, double score = NAN);
 	void copyInStartValues();
 	void copyOutValues(const lbfgsfloatval_t *x);
 
 	void *_gradObj;
 	Getter _func;
+	VectorGradient _vectorGrad;
+	void *_vectorObj;
 	lbfgsfloatval_t _fx;
 	LbfgsVector _xs;
 	LbfgsVector _gs;
+
+	int _history;
+	int _maxIterations;
+	int _lineSteps;
+	
+	/* correction pairs kept between calls for warm starts */
+	boost::shared_ptr<lbfgs_history_t> _memory;
+	
+	/* iterations before this call of lbfgs(), if resumed, and so far;
+	 * the point reached is only known during the progress callback */
+	int _doneIterations;
+	int _iteration;
+	const lbfgsfloatval_t *_progressX;
+	boost::shared_ptr<ThreadPool> _vectorPool;
+	std::vector<double> _partials;
+	lbfgs_vector_ops_t _ops;
 };
 
 #endif
@@ -30,7 +30,7 @@ void RefinementList::addTestSet(std::vector<double> &vals)
 {
 	if (parameterCount() != vals.size())
 	{
-		std::cout << "Test set has different parameter number" << std::endl;
+		*_stream << "Test set has different parameter number" << std::endl;
 		return;
 	}
 
@@ -39,12 +39,7 @@ void RefinementList::addTestSet(std::vector<double> &vals)
 
 void RefinementList::applyTest(int num)
 {
-	std::vector<double> test = _tests[num];
-
-	for (int i = 0; i < test.size(); i++)
-	{
-		setValueForParam(i, test[i]);
-	}
+	setValuesForParams(&_tests[num][0]);
 }
 
 void RefinementList::refine()
@@ -53,11 +48,14 @@ void RefinementList::refine()
 	int bestCycle = 0;
 	double bestScore = _prevScore;
 	
-	while (_cycleNum < _tests.size())
-	{
-		applyTest(_cycleNum);
+	std::vector<std::vector<double> > remaining;
+	remaining.insert(remaining.end(), _tests.begin() + _cycleNum, 
+	                 _tests.end());
+	std::vector<double> evals = evaluateBatch(remaining);
 
-		double eval = (*evaluationFunction)(evaluateObject);
+	for (size_t i = 0; i < evals.size(); i++)
+	{
+		double eval = evals[i];
 
 		if (eval < bestScore)
 		{
@@ -20,11 +20,75 @@
 #define __vagabond__NelderMead__
 
 #include <stdio.h>
+#include <algorithm>
 #include "RefinementStrategy.h"
-#include <map>
+#include "Checkpoint.h"
 
 typedef std::pair<std::vector<double>, double> TestPoint;
-typedef std::map<int, double> StepMap;
+
+/** \class NelderMeadSimplex
+ *  \brief Simplex storage for any number of parameters. The Nelder-Mead
+ *  logic in RefinementNelderMead works on any class with these members;
+ *  see NelderMeadFixedSimplex for one held in fixed-size arrays.
+ **/
+
+struct NelderMeadSimplex
+{
+	/* size of the simplex is n + 1 vertices of n parameters each */
+	size_t n;
+
+	/* vertex v occupies vertices[v * n] to vertices[v * n + n - 1] */
+	std::vector<double> vertices;
+	std::vector<double> scores;
+
+	/* vertex numbers from best to worst score */
+	std::vector<int> order;
+
+	/* running total of all vertices, for the centroid */
+	std::vector<double> sum;
+	std::vector<double> centroid;
+
+	/* reflected, expanded and contracted trial points */
+	std::vector<double> trials;
+	double trialScores[3];
+	std::vector<double> batchScores;
+
+	/* size of the most recent move for each parameter */
+	std::vector<double> steps;
+
+	void allocate(size_t count)
+	{
+		n = count;
+		vertices.resize((n + 1) * n);
+		scores.resize(n + 1);
+		order.resize(n + 1);
+		sum.resize(n);
+		centroid.resize(n);
+		trials.resize(3 * n);
+		batchScores.resize(2 * (n + 1));
+		steps.resize(n);
+	}
+
+	double *vertex(int v)
+	{
+		return &vertices[v * n];
+	}
+
+	double *trial(int t)
+	{
+		return &trials[t * n];
+	}
+
+	/* calls f(i) for every parameter i */
+	template <class F>
+	void each(F f)
+	{
+		for (size_t i = 0; i < n; i++)
+		{
+			f(i);
+		}
+	}
+};
 
 class RefinementNelderMead : public RefinementStrategy
 {
@@ -38,39 +102,463 @@ public:
 		_flip = flip;
 	}
 
+	/* when evaluating in parallel, score the reflected, expanded and
+	 * contracted points of each iteration together */
+	void setSpeculative(bool speculative = true)
+	{
+		_speculative = speculative;
+	}
+
 	virtual void clearParameters();
-private:
+protected:
 	double _alpha;
 	double _gamma;
 	double _rho;
 	double _sigma;
 	bool _flip;
-	
-	StepMap _stepMap;
-	std::string _lastTag;
-
-	std::vector<TestPoint> testPoints;
-
-	void setWorstTestPoint(TestPoint &newPoint);
-	void setInitialParameters();
-	void setParametersForPoint(int i, double mult = 1);
-	TestPoint *worstTestPoint();
-	void orderTestPoints();
-	void evaluateTestPoint(int num);
-	void evaluateTestPoint(TestPoint *testPoint);
-	void setTestPointParameters(TestPoint *testPoint);
-	std::vector<double> calculateCentroid();
-
-	TestPoint reflectOrExpand(std::vector<double> centroid, double scale);
-	TestPoint reflectedPoint(std::vector<double> centroid);
-	TestPoint expandedPoint(std::vector<double> centroid);
-	TestPoint contractedPoint(std::vector<double> centroid);
-	void reduction();
-	bool converged();
-
-	void addPoints(std::vector<double> *point, std::vector<double> pointToAdd);
-	void scalePoint(std::vector<double> *point, double scale);
-	void subtractPoints(std::vector<double> *point, std::vector<double> pointToSubtract);
+	bool _speculative;
+	int _iteration;
+	bool _haveSteps;
+	int _lastParam;
+
+	virtual void writeState(std::ostream &out);
+	virtual bool readState(std::istream &in);
+
+	/* the whole method, on whichever simplex storage S is given */
+	template <class S>
+	void refineSimplex(S &s);
+
+	template <class S>
+	void writeSimplex(S &s, std::ostream &out);
+
+	template <class S>
+	bool readSimplex(S &s, std::istream &in);
+private:
+	NelderMeadSimplex _simplex;
+
+	template <class S>
+	double score(S &s, int rank)
+	{
+		return s.scores[s.order[rank]];
+	}
+
+	template <class S>
+	double *worstVertex(S &s)
+	{
+		return s.vertex(s.order[s.n]);
+	}
+
+	void setPointParameters(const double *point);
+	double evaluatePoint(const double *point);
+
+	template <class S> void setInitialParameters(S &s);
+	template <class S> void sortVertices(S &s);
+	template <class S> void recalculateSum(S &s);
+	template <class S> void calculateCentroid(S &s);
+	template <class S> void moveFromWorst(S &s, double scale, double *dest);
+	template <class S> void setStepsForScale(S &s, double scale);
+	template <class S> void evaluateTrials(S &s, int count);
+	template <class S> void replaceWorst(S &s, const double *point, 
+	                                     double score);
+	template <class S> bool speculativeStep(S &s);
+	template <class S> bool serialStep(S &s);
+	template <class S> void reduction(S &s);
+	template <class S> bool converged(S &s);
 };
 
+template <class S>
+bool RefinementNelderMead::converged(S &s)
+{
+	if (!_haveSteps)
+	{
+		return false;
+	}
+
+	for (size_t i = 0; i < s.n; i++)
+	{
+		double limit = _params.otherValue(i);
+		
+		if (fabs(s.steps[i]) > fabs(limit))
+		{
+			_lastParam = i;
+			return false;	
+		}
+	}
+	
+	return true;
+}
+
+template <class S>
+void RefinementNelderMead::recalculateSum(S &s)
+{
+	s.each([&](int i) { s.sum[i] = 0; });
+
+	for (size_t v = 0; v <= s.n; v++)
+	{
+		double *point = s.vertex(v);
+		s.each([&](int i) { s.sum[i] += point[i]; });
+	}
+}
+
+template <class S>
+void RefinementNelderMead::sortVertices(S &s)
+{
+	for (size_t v = 0; v <= s.n; v++)
+	{
+		s.order[v] = v;
+	}
+
+	/* ties broken by vertex number so the order is reproducible */
+	std::sort(s.order.begin(), s.order.begin() + s.n + 1, [&s](int a, int b)
+	{
+		return (s.scores[a] < s.scores[b] || 
+		        (s.scores[a] == s.scores[b] && a < b));
+	});
+}
+
+template <class S>
+void RefinementNelderMead::calculateCentroid(S &s)
+{
+	/* all vertices but the worst, in O(n) from the running total */
+	double *worst = worstVertex(s);
+	double n = s.n;
+
+	s.each([&](int i)
+	{
+		s.centroid[i] = (s.sum[i] - worst[i]) / n;
+	});
+}
+
+template <class S>
+void RefinementNelderMead::moveFromWorst(S &s, double scale, double *dest)
+{
+	double *worst = worstVertex(s);
+
+	s.each([&](int i)
+	{
+		dest[i] = s.centroid[i] + (s.centroid[i] - worst[i]) * scale;
+	});
+}
+
+template <class S>
+void RefinementNelderMead::setStepsForScale(S &s, double scale)
+{
+	double *worst = worstVertex(s);
+
+	s.each([&](int i)
+	{
+		s.steps[i] = fabs((s.centroid[i] - worst[i]) * scale);
+	});
+
+	_haveSteps = true;
+}
+
+template <class S>
+void RefinementNelderMead::evaluateTrials(S &s, int count)
+{
+	evaluateIndexed(count, [&s](size_t idx, double *vals)
+	{
+		std::copy(s.trial(idx), s.trial(idx) + s.n, vals);
+	}, s.trialScores);
+}
+
+template <class S>
+void RefinementNelderMead::replaceWorst(S &s, const double *point, 
+                                        double score)
+{
+	int v = s.order[s.n];
+	double *worst = s.vertex(v);
+
+	s.each([&](int i)
+	{
+		s.sum[i] += point[i] - worst[i];
+		worst[i] = point[i];
+	});
+
+	s.scores[v] = score;
+
+	/* single insertion step to put the new vertex in its place */
+	int rank = s.n;
+	while (rank > 0 && s.scores[s.order[rank - 1]] > score)
+	{
+		s.order[rank] = s.order[rank - 1];
+		rank--;
+	}
+
+	s.order[rank] = v;
+}
+
+template <class S>
+void RefinementNelderMead::reduction(S &s)
+{
+	int best = s.order[0];
+	double *bestPoint = s.vertex(best);
+	double sigma = _sigma;
+
+	for (size_t v = 0; v <= s.n; v++)
+	{
+		if ((int)v == best)
+		{
+			continue;
+		}
+
+		double *point = s.vertex(v);
+		s.each([&](int i)
+		{
+			point[i] = bestPoint[i] + (point[i] - bestPoint[i]) * sigma;
+		});
+	}
+	
+	/* all contracted vertices are independent of one another */
+	evaluateIndexed(s.n, [&s, best](size_t idx, double *vals)
+	{
+		int v = (idx < (size_t)best ? idx : idx + 1);
+		std::copy(s.vertex(v), s.vertex(v) + s.n, vals);
+	}, &s.batchScores[0]);
+
+	for (size_t idx = 0; idx < s.n; idx++)
+	{
+		int v = (idx < (size_t)best ? idx : idx + 1);
+		s.scores[v] = s.batchScores[idx];
+	}
+
+	recalculateSum(s);
+	sortVertices(s);
+}
+
+template <class S>
+void RefinementNelderMead::setInitialParameters(S &s)
+{
+	int sides = (_flip ? 2 : 1);
+	
+	/* First test point is in the centre */
+	double *centre = s.vertex(0);
+	for (size_t j = 0; j < s.n; j++)
+	{
+		centre[j] = getValueForParam(j);
+	}
+
+	/* steps are unused until the first move, so hold the initial steps:
+	 * step sizes, or on a warm start how far parameters moved last time */
+	for (size_t j = 0; j < s.n; j++)
+	{
+		s.steps[j] = warmStepForParam(j);
+	}
+
+	/* All other test points increase the step size by a certain amount
+	 * in one direction; with flipping, both directions are tried. Every 
+	 * candidate vertex is scored in one batch. */
+	evaluateIndexed((s.n + 1) * sides, [&s, sides](size_t idx, double *vals)
+	{
+		int v = idx / sides;
+		double mult = (idx % sides == 0 ? 1 : -1);
+		std::copy(s.vertex(0), s.vertex(0) + s.n, vals);
+
+		if (v > 0)
+		{
+			vals[v - 1] += mult * s.steps[v - 1];
+		}
+	}, &s.batchScores[0]);
+
+	for (size_t v = 0; v <= s.n; v++)
+	{
+		int choice = sides * v;
+
+		if (_flip && !(s.batchScores[choice] < s.batchScores[choice + 1]))
+		{
+			choice++;
+		}
+
+		double *point = s.vertex(v);
+		s.each([&](int j) { point[j] = centre[j]; });
+
+		if (v > 0)
+		{
+			double mult = (choice % sides == 0 ? 1 : -1);
+			point[v - 1] += mult * s.steps[v - 1];
+		}
+
+		s.scores[v] = s.batchScores[choice];
+	}
+
+	recalculateSum(s);
+	sortVertices(s);
+}
+
+template <class S>
+bool RefinementNelderMead::speculativeStep(S &s)
+{
+	moveFromWorst(s, _alpha, s.trial(0));
+	moveFromWorst(s, _gamma, s.trial(1));
+	moveFromWorst(s, _rho, s.trial(2));
+	evaluateTrials(s, 3);
+
+	double reflected = s.trialScores[0];
+	double expanded = s.trialScores[1];
+	double contracted = s.trialScores[2];
+	
+	/* same decisions as the serial path, which would have evaluated
+	 * the expanded or contracted point only when needed */
+	if (reflected < score(s, 1) && reflected > score(s, 0))
+	{
+		setStepsForScale(s, _alpha);
+		replaceWorst(s, s.trial(0), reflected);
+		return true;
+	}
+
+	if (reflected < score(s, 0))
+	{
+		setStepsForScale(s, _gamma);
+		bool expandedBetter = (expanded < reflected);
+		replaceWorst(s, s.trial(expandedBetter ? 1 : 0), 
+		             expandedBetter ? expanded : reflected);
+		return true;
+	}
+
+	setStepsForScale(s, _rho);
+
+	if (contracted < score(s, s.n))
+	{
+		replaceWorst(s, s.trial(2), contracted);
+		return true;
+	}
+
+	return false;
+}
+
+template <class S>
+bool RefinementNelderMead::serialStep(S &s)
+{
+	moveFromWorst(s, _alpha, s.trial(0));
+	setStepsForScale(s, _alpha);
+	double reflected = evaluatePoint(s.trial(0));
+
+	if (reflected < score(s, 1) && reflected > score(s, 0))
+	{
+		replaceWorst(s, s.trial(0), reflected);
+		return true;
+	}
+
+	if (reflected < score(s, 0))
+	{
+		moveFromWorst(s, _gamma, s.trial(1));
+		setStepsForScale(s, _gamma);
+		double expanded = evaluatePoint(s.trial(1));
+		bool expandedBetter = (expanded < reflected);
+		replaceWorst(s, s.trial(expandedBetter ? 1 : 0), 
+		             expandedBetter ? expanded : reflected);
+
+		return true;
+	}
+
+	moveFromWorst(s, _rho, s.trial(2));
+	setStepsForScale(s, _rho);
+	double contracted = evaluatePoint(s.trial(2));
+
+	if (contracted < score(s, s.n))
+	{
+		replaceWorst(s, s.trial(2), contracted);
+		return true;
+	}
+
+	return false;
+}
+
+template <class S>
+void RefinementNelderMead::refineSimplex(S &s)
+{
+	s.allocate(parameterCount());
+	_haveSteps = false;
+	_iteration = 0;
+
+	if (!resumeState())
+	{
+		setInitialParameters(s);
+	}
+
+	init();
+	
+	bool speculate = (_speculative && parallelEvaluation());
+
+	while ((!converged(s) && _iteration < maxCycles))
+	{
+		calculateCentroid(s);
+		_iteration++;
+
+		reportProgress(score(s, 0));
+
+		bool replaced = (speculate ? speculativeStep(s) : serialStep(s));
+
+		if (!replaced)
+		{
+			reduction(s);
+		}
+		else if (_iteration % s.n == 0)
+		{
+			/* stop rounding errors in the running total from creeping */
+			recalculateSum(s);
+		}
+
+		checkpoint();
+	}
+
+	reportProgress(score(s, 0));
+	setPointParameters(s.vertex(s.order[0]));
+
+	finish();
+}
+
+template <class S>
+void RefinementNelderMead::writeSimplex(S &s, std::ostream &out)
+{
+	std::vector<double> vertices, scores, steps;
+
+	for (size_t v = 0; v <= s.n; v++)
+	{
+		vertices.insert(vertices.end(), s.vertex(v), s.vertex(v) + s.n);
+		scores.push_back(s.scores[v]);
+	}
+
+	steps.insert(steps.end(), &s.steps[0], &s.steps[0] + s.n);
+
+	writeBinary(out, (int32_t)_iteration);
+	writeBinary(out, (int32_t)_haveSteps);
+	writeBinaryVector(out, vertices);
+	writeBinaryVector(out, scores);
+	writeBinaryVector(out, steps);
+}
+
+template <class S>
+bool RefinementNelderMead::readSimplex(S &s, std::istream &in)
+{
+	int32_t iteration = 0;
+	int32_t haveSteps = 0;
+	std::vector<double> vertices, scores, steps;
+	size_t n = s.n;
+
+	if (!(readBinary(in, iteration) && readBinary(in, haveSteps) &&
+	      readBinaryVector(in, vertices) && readBinaryVector(in, scores) &&
+	      readBinaryVector(in, steps) && vertices.size() == (n + 1) * n &&
+	      scores.size() == n + 1 && steps.size() == n))
+	{
+		return false;
+	}
+
+	for (size_t v = 0; v <= n; v++)
+	{
+		std::copy(vertices.begin() + v * n, vertices.begin() + (v + 1) * n,
+		          s.vertex(v));
+		s.scores[v] = scores[v];
+	}
+
+	std::copy(steps.begin(), steps.end(), &s.steps[0]);
+	_iteration = iteration;
+	_haveSteps = haveSteps;
+
+	recalculateSum(s);
+	sortVertices(s);
+
+	return true;
+}
+
 #endif /* defined(__vagabond__NelderMead__) */
@@ -0,0 +1,148 @@
+// Vagabond
+// Copyright (C) 2019 Helen Ginn
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+// Please email: vagabond @ hginn.co.uk for more details.
+
+#ifndef __vagabond__RefinementNelderMeadFixed__
+#define __vagabond__RefinementNelderMeadFixed__
+
+#include <array>
+#include "RefinementNelderMead.h"
+
+/* calls f(I), f(I + 1) ... f(N - 1) with no loop left at run time */
+template <int I, int N>
+struct NelderUnroll
+{
+	template <class F>
+	static void run(F f)
+	{
+		f(I);
+		NelderUnroll<I + 1, N>::run(f);
+	}
+};
+
+template <int N>
+struct NelderUnroll<N, N>
+{
+	template <class F>
+	static void run(F)
+	{
+
+	}
+};
+
+/** \class NelderMeadFixedSimplex
+ *  \brief Simplex storage for up to N parameters in fixed-size arrays,
+ *  with the per-parameter loops unrolled at compile time. Fewer than N
+ *  parameters are padded with zeros which never move.
+ **/
+
+template <int N>
+struct NelderMeadFixedSimplex
+{
+	size_t n;
+	std::array<double, (N + 1) * N> vertices;
+	std::array<double, N + 1> scores;
+	std::array<int, N + 1> order;
+	std::array<double, N> sum;
+	std::array<double, N> centroid;
+	std::array<double, 3 * N> trials;
+	double trialScores[3];
+	std::array<double, 2 * (N + 1)> batchScores;
+	std::array<double, N> steps;
+
+	void allocate(size_t count)
+	{
+		n = count;
+		vertices.fill(0);
+		trials.fill(0);
+		steps.fill(0);
+	}
+
+	double *vertex(int v)
+	{
+		return &vertices[v * N];
+	}
+
+	double *trial(int t)
+	{
+		return &trials[t * N];
+	}
+
+	template <class F>
+	void each(F f)
+	{
+		NelderUnroll<0, N>::run(f);
+	}
+};
+
+/** \class RefinementNelderMeadFixed
+ *  \brief RefinementNelderMead with the simplex held in a
+ *  NelderMeadFixedSimplex<N>. With more than N parameters, the dynamically
+ *  sized simplex is used instead.
+ **/
+
+template <int N>
+class RefinementNelderMeadFixed : public RefinementNelderMead
+{
+public:
+	RefinementNelderMeadFixed() : RefinementNelderMead()
+	{
+		_fixed.n = 0;
+	}
+
+	virtual void refine()
+	{
+		if (!fits())
+		{
+			RefinementNelderMead::refine();
+			return;
+		}
+
+		RefinementStrategy::refine();
+		refineSimplex(_fixed);
+	}
+protected:
+	virtual void writeState(std::ostream &out)
+	{
+		if (!fits())
+		{
+			RefinementNelderMead::writeState(out);
+			return;
+		}
+
+		writeSimplex(_fixed, out);
+	}
+
+	virtual bool readState(std::istream &in)
+	{
+		if (!fits())
+		{
+			return RefinementNelderMead::readState(in);
+		}
+
+		return readSimplex(_fixed, in);
+	}
+private:
+	bool fits()
+	{
+		return (parameterCount() > 0 && parameterCount() <= N);
+	}
+
+	NelderMeadFixedSimplex<N> _fixed;
+};
+
+#endif
@@ -0,0 +1,213 @@
+// Vagabond
+// Copyright (C) 2019 Helen Ginn
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+// Please email: vagabond @ hginn.co.uk for more details.
+
+#include "RefinementScheduler.h"
+#include <sstream>
+#include <iostream>
+#include "ThreadPool.h"
+
+/* scheduler whose worker owns the current thread, and which worker */
+static thread_local RefinementScheduler *_currentScheduler = NULL;
+static thread_local int _currentWorker = 0;
+
+RefinementScheduler::RefinementScheduler(int threads) 
+: _queues(threads > 0 ? threads : ThreadPool::hardwareThreads())
+{
+	_queued = 0;
+	_pending = 0;
+	_nextQueue = 0;
+	_quit = false;
+	_echo = false;
+
+	for (size_t i = 0; i < _queues.size(); i++)
+	{
+		_threads.push_back(std::thread(&RefinementScheduler::work, this, i));
+	}
+}
+
+RefinementScheduler::~RefinementScheduler()
+{
+	wait();
+
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_quit = true;
+	}
+
+	_wake.notify_all();
+
+	for (size_t i = 0; i < _threads.size(); i++)
+	{
+		_threads[i].join();
+	}
+}
+
+std::future<RefinementResult> 
+RefinementScheduler::submit(RefinementStrategyPtr strategy)
+{
+	Job job;
+	job.strategy = strategy;
+	std::future<RefinementResult> future = job.promise.get_future();
+
+	size_t which = 0;
+
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_pending++;
+		_queued++;
+
+		if (_currentScheduler == this)
+		{
+			which = _currentWorker;
+		}
+		else
+		{
+			which = _nextQueue;
+			_nextQueue = (_nextQueue + 1) % _queues.size();
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(_queues[which].mutex);
+		_queues[which].jobs.push_back(std::move(job));
+	}
+
+	_wake.notify_one();
+
+	return future;
+}
+
+void RefinementScheduler::wait()
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+	_idle.wait(lock, [&] { return _pending == 0; });
+}
+
+bool RefinementScheduler::takeJob(int worker, Job &job)
+{
+	/* newest of our own first, while its data may still be in cache */
+	{
+		Queue &own = _queues[worker];
+		std::lock_guard<std::mutex> lock(own.mutex);
+
+		if (own.jobs.size())
+		{
+			job = std::move(own.jobs.back());
+			own.jobs.pop_back();
+			return true;
+		}
+	}
+
+	for (size_t i = 1; i < _queues.size(); i++)
+	{
+		Queue &other = _queues[(worker + i) % _queues.size()];
+		std::lock_guard<std::mutex> lock(other.mutex);
+
+		if (other.jobs.size())
+		{
+			job = std::move(other.jobs.front());
+			other.jobs.pop_front();
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void RefinementScheduler::work(int worker)
+{
+	_currentScheduler = this;
+	_currentWorker = worker;
+
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_wake.wait(lock, [&] { return _quit || _queued > 0; });
+
+			if (_queued == 0)
+			{
+				return;
+			}
+		}
+
+		Job job;
+		if (!takeJob(worker, job))
+		{
+			/* taken by another worker, or not yet pushed by submit() */
+			std::this_thread::yield();
+			continue;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_queued--;
+		}
+
+		runJob(job);
+
+		std::lock_guard<std::mutex> lock(_mutex);
+		_pending--;
+		if (_pending == 0)
+		{
+			_idle.notify_all();
+		}
+	}
+}
+
+void RefinementScheduler::runJob(Job &job)
+{
+	RefinementResult result;
+	result.strategy = job.strategy;
+	result.changed = false;
+	result.improvement = 0;
+
+	if (!job.strategy)
+	{
+		job.promise.set_value(result);
+		return;
+	}
+
+	std::ostringstream buffer;
+	std::ostream *previous = job.strategy->stream();
+	job.strategy->setStream(&buffer);
+
+	try
+	{
+		job.strategy->refine();
+	}
+	catch (...)
+	{
+		job.strategy->setStream(previous);
+		job.promise.set_exception(std::current_exception());
+		return;
+	}
+
+	job.strategy->setStream(previous);
+	result.changed = job.strategy->didChange();
+	result.improvement = job.strategy->improvement();
+	result.output = buffer.str();
+
+	if (_echo && result.output.length())
+	{
+		std::lock_guard<std::mutex> lock(_echoMutex);
+		std::cout << result.output << std::flush;
+	}
+
+	job.promise.set_value(result);
+}
@@ -0,0 +1,112 @@
+// Vagabond
+// Copyright (C) 2019 Helen Ginn
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+// Please email: vagabond @ hginn.co.uk for more details.
+
+#ifndef __vagabond__RefinementScheduler__
+#define __vagabond__RefinementScheduler__
+
+#include <deque>
+#include <mutex>
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+#include "RefinementStrategy.h"
+
+struct RefinementResult
+{
+	RefinementStrategyPtr strategy;
+	bool changed;
+	double improvement;
+
+	/* everything the strategy wrote to its stream during the job */
+	std::string output;
+};
+
+/** \class RefinementScheduler
+ *  \brief Runs many independent refinements at once over a fixed set of
+ *  worker threads.
+ *
+ *  Each worker keeps its own queue of jobs, taking the newest from its
+ *  own and stealing the oldest from the others once it runs dry. Each
+ *  strategy writes to a buffer of its own for the length of its job, so
+ *  concurrent jobs never share std::cout. Strategies must not share
+ *  evaluation objects with other jobs running at the same time.
+ **/
+
+class RefinementScheduler
+{
+public:
+	RefinementScheduler(int threads = 0);
+
+	/* finishes all jobs already submitted */
+	~RefinementScheduler();
+
+	int threadCount()
+	{
+		return _threads.size();
+	}
+
+	/* writes the output of each job to std::cout in one piece when it
+	 * finishes, rather than only returning it in the result */
+	void setEcho(bool echo)
+	{
+		_echo = echo;
+	}
+
+	/* queues strategy->refine(); exceptions it throws are passed on by
+	 * the future. Jobs submitted from within a job go to the queue of
+	 * the worker running it. */
+	std::future<RefinementResult> submit(RefinementStrategyPtr strategy);
+
+	/* returns once every job submitted so far has finished. Must not be
+	 * called from within a job. */
+	void wait();
+private:
+	struct Job
+	{
+		RefinementStrategyPtr strategy;
+		std::promise<RefinementResult> promise;
+	};
+
+	struct Queue
+	{
+		std::mutex mutex;
+		std::deque<Job> jobs;
+	};
+
+	void work(int worker);
+	bool takeJob(int worker, Job &job);
+	void runJob(Job &job);
+
+	std::vector<std::thread> _threads;
+	std::vector<Queue> _queues;
+
+	std::mutex _mutex;
+	std::condition_variable _wake;
+	std::condition_variable _idle;
+	size_t _queued;
+	size_t _pending;
+	size_t _nextQueue;
+	bool _quit;
+
+	bool _echo;
+	std::mutex _echoMutex;
+};
+
+#endif
@@ -18,6 +18,7 @@
 
 #include "RefinementStepSearch.h"
 #include "FileReader.h"
+#include "Checkpoint.h"
 #include <float.h>
 
 double RefinementStepSearch::minimizeTwoParameters(int whichParam1, int whichParam2, double *bestScore)
@@ -26,14 +27,11 @@ double RefinementStepSearch::minimizeTwoParameters(int whichParam1, int whichPar
 	double param_trials2[9];
 	double param_scores[9];
 
-	Parameter *param1 = &_params[whichParam1];
-	Parameter *param2 = &_params[whichParam2];
-	
-	double *meanStep1 = &param1->step_size;
-	double *meanStep2 = &param2->step_size;
+	double *meanStep1 = &_params.stepSize(whichParam1);
+	double *meanStep2 = &_params.stepSize(whichParam2);
 
-	if (*meanStep1 < param1->other_value &&
-	    *meanStep2 < param2->other_value)
+	if (*meanStep1 < _params.otherValue(whichParam1) &&
+	    *meanStep2 < _params.otherValue(whichParam2))
 	{
 		return 1;
 	}
@@ -42,16 +40,8 @@ double RefinementStepSearch::minimizeTwoParameters(int whichParam1, int whichPar
 	double param_min_score = *bestScore;
 	int param_min_num = 4;
 
-	Getter getter1 = param1->getter;
-	Setter setter1 = param1->setter;
-	void *object1 = param1->object;
-
-	Getter getter2 = param2->getter;
-	Setter setter2 = param2->setter;
-	void *object2 = param2->object;
-
-	double bestParam1 = (*getter1)(object1);
-	double bestParam2 = (*getter2)(object2);
+	double bestParam1 = getValueForParam(whichParam1);
+	double bestParam2 = getValueForParam(whichParam2);
 
 	for (double i = bestParam1 - *meanStep1; j < 3; i += *meanStep1)
 	{
@@ -59,10 +49,10 @@ double RefinementStepSearch::minimizeTwoParameters(int whichParam1, int whichPar
 
 		for (double k = bestParam2 - *meanStep2; l < 3; k += *meanStep2)
 		{
-			(*setter1)(object1, i);
-			(*setter2)(object2, k);
+			setValueForParam(whichParam1, i);
+			setValueForParam(whichParam2, k);
 
-			double aScore = (*evaluationFunction)(evaluateObject);
+			double aScore = evaluateScore();
 
 			if (aScore != aScore)
 			{
@@ -86,8 +76,8 @@ double RefinementStepSearch::minimizeTwoParameters(int whichParam1, int whichPar
 		param_min_num = i;
 	}
 
-	(*setter1)(object1, param_trials1[param_min_num]);
-	(*setter2)(object2, param_trials2[param_min_num]);
+	setValueForParam(whichParam1, param_trials1[param_min_num]);
+	setValueForParam(whichParam2, param_trials2[param_min_num]);
 
 	if (param_min_num == 4)
 	{
@@ -104,22 +94,17 @@ double RefinementStepSearch::minimizeParameter(int whichParam, double *bestScore
 {
 	double param_trials[3];
 	double param_scores[3];
-	Parameter *param = &_params[whichParam];
 
-	double step = param->step_size;
-	if (step < param->other_value)
+	double step = _params.stepSize(whichParam);
+	if (step < _params.otherValue(whichParam))
 	{
 		return 1;
 	}
 
-	Getter getter = param->getter;
-	Setter setter = param->setter;
-	void *object = param->object;
-
 	int j = 0;
 	int param_min_num = 1;
 
-	double bestParam = (*getter)(object);
+	double bestParam = getValueForParam(whichParam);
 
 	if (*bestScore != FLT_MAX)
 	{
@@ -127,7 +112,7 @@ double RefinementStepSearch::minimizeParameter(int whichParam, double *bestScore
 	}
 	else
 	{
-		double aScore = (*evaluationFunction)(evaluateObject);
+		double aScore = evaluateScore();
 		if (aScore != aScore)
 		{
 			aScore = FLT_MAX;
@@ -140,9 +125,9 @@ double RefinementStepSearch::minimizeParameter(int whichParam, double *bestScore
 
 	for (double i = bestParam - step; j < 3; i += step * 2)
 	{
-		(*setter)(object, i);
+		setValueForParam(whichParam, i);
 
-		double aScore = (*evaluationFunction)(evaluateObject);
+		double aScore = evaluateScore();
 
 		if (aScore != aScore)
 		{
@@ -163,54 +148,132 @@ double RefinementStepSearch::minimizeParameter(int whichParam, double *bestScore
 		param_min_num = i;
 	}
 
-	(*setter)(object, param_trials[param_min_num]);
+	setValueForParam(whichParam, param_trials[param_min_num]);
 
 	*bestScore = param_min_score;
 
 	if (param_min_num == 1)
-	param->step_size /= 2;
+	_params.stepSize(whichParam) /= 2;
 
 	return 0;
 }
 
+void RefinementStepSearch::useWarmSteps()
+{
+	if (!_warmValid)
+	{
+		return;
+	}
+
+	for (size_t i = 0; i < parameterCount(); i++)
+	{
+		_params.stepSize(i) = fabs(warmStepForParam(i));
+	}
+}
+
+void RefinementStepSearch::writeState(std::ostream &out)
+{
+	std::vector<double> steps, values;
+
+	for (size_t i = 0; i < parameterCount(); i++)
+	{
+		steps.push_back(_params.stepSize(i));
+		values.push_back(getValueForParam(i));
+	}
+
+	writeBinary(out, (int32_t)_cycle);
+	writeBinary(out, (uint64_t)_nextParam);
+	writeBinary(out, _bestScore);
+	writeBinary(out, (int32_t)_allFinished);
+	writeBinaryVector(out, steps);
+	writeBinaryVector(out, values);
+}
+
+bool RefinementStepSearch::readState(std::istream &in)
+{
+	int32_t cycle = 0;
+	int32_t finished = 0;
+	uint64_t next = 0;
+	double best = 0;
+	std::vector<double> steps, values;
+
+	if (!(readBinary(in, cycle) && readBinary(in, next) && 
+	      readBinary(in, best) && readBinary(in, finished) &&
+	      readBinaryVector(in, steps) && readBinaryVector(in, values) &&
+	      steps.size() == parameterCount() && 
+	      values.size() == parameterCount()))
+	{
+		return false;
+	}
+
+	for (size_t i = 0; i < parameterCount(); i++)
+	{
+		_params.stepSize(i) = steps[i];
+	}
+
+	setValuesForParams(&values[0]);
+
+	_cycle = cycle;
+	_nextParam = next;
+	_bestScore = best;
+	_allFinished = finished;
+
+	return true;
+}
+
 void RefinementStepSearch::refine()
 {
 	RefinementStrategy::refine();
+	useWarmSteps();
 
-	double bestScore = FLT_MAX;
+	_cycle = 0;
+	_nextParam = 0;
+	_bestScore = FLT_MAX;
+	_allFinished = true;
+	resumeState();
 
-	for (int i = 0; i < maxCycles; i++)
+	for (; _cycle < maxCycles; _cycle++)
 	{
-		bool allFinished = true;
-
-		if (afterCycleObject && afterCycleFunction)
+		if (_nextParam == 0)
 		{
-			bestScore = FLT_MAX;
+			_allFinished = true;
+
+			if (afterCycleObject && afterCycleFunction)
+			{
+				_bestScore = FLT_MAX;
+			}
 		}
 
-		for (size_t j = 0; j < parameterCount(); j++)
+		while (_nextParam < parameterCount())
 		{
-			bool coupled = (_params[j].coupled > 1);
+			size_t j = _nextParam;
+			bool coupled = (_params.coupled(j) > 1);
 
 			if (!coupled)
 			{
-				allFinished *= minimizeParameter(j, &bestScore);
+				_allFinished *= minimizeParameter(j, &_bestScore);
+				_nextParam++;
 			}
 			else
 			{
-				allFinished *= minimizeTwoParameters(j, j + 1, &bestScore);
-				j++;
+				_allFinished *= minimizeTwoParameters(j, j + 1, &_bestScore);
+				_nextParam += 2;
 			}
+
+			checkpoint();
 		}
 
+		_nextParam = 0;
+
 		if (afterCycleObject && afterCycleFunction)
 		{
+			flushRefresh();
 			(*afterCycleFunction)(afterCycleObject);
 		}
 
-		reportProgress(bestScore);
+		reportProgress(_bestScore);
 
-		if (allFinished)
+		if (_allFinished)
 		{
 			break;
 		}
@@ -218,4 +281,3 @@ void RefinementStepSearch::refine()
 
 	finish();
 }
-
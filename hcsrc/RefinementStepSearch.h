@@ -42,10 +42,20 @@ public:
 private:
 	double minimizeParameter(int i, double *bestScore);
 	double minimizeTwoParameters(int whichParam1, int whichParam2, double *bestScore);
+	void useWarmSteps();
+
+	virtual void writeState(std::ostream &out);
+	virtual bool readState(std::istream &in);
 
 	Getter afterCycleFunction;
 	void *afterCycleObject;
 
+	/* where refine() has got to, for checkpoints */
+	int _cycle;
+	size_t _nextParam;
+	double _bestScore;
+	bool _allFinished;
+
 };
 
 #endif /* defined(__vagabond__RefinementStepSearch__) */
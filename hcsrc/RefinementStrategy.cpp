@@ -21,14 +21,24 @@
 #include "RefinementNelderMead.h"
 #include "RefinementStrategy.h"
 #include "FileReader.h"
+#include "Checkpoint.h"
 #include <iostream>
 #include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <iterator>
+#include <typeinfo>
+#include <algorithm>
+
+#define CHECKPOINT_MAGIC "HCCK"
+#define CHECKPOINT_VERSION 1
 
 RefinementStrategy::RefinementStrategy()
 {
 	_enough = false;
 	evaluationFunction = NULL;
 	_partial = NULL;
+	_gradMode = GradientCentral;
 	maxCycles = 30;
 	cycleNum = 0;
 	startingScore = 0;
@@ -40,6 +50,352 @@ RefinementStrategy::RefinementStrategy()
 	_improvement = 0;
 	_toDegrees = false;
 	_stream = &std::cout;
+	_cloneFactory = NULL;
+	_cloneScore = NULL;
+	_cloneRelease = NULL;
+	_threads = 1;
+	_warm = false;
+	_warmValid = false;
+	_evalCount = 0;
+	_checkpointInterval = 0;
+	_lastCheckpoint = 0;
+	_resuming = false;
+	_allTermsDirty = true;
+	_termTotal = 0;
+	_termUpdates = 0;
+	_termEvaluations = 0;
+}
+
+void RefinementStrategy::setCloneFunctions(CloneFactory factory, 
+                                           VectorScore score,
+                                           CloneRelease release)
+{
+	_cloneFactory = factory;
+	_cloneScore = score;
+	_cloneRelease = release;
+	makeEvaluationPool();
+}
+
+void RefinementStrategy::setThreads(int threads)
+{
+	if (threads <= 0)
+	{
+		threads = ThreadPool::hardwareThreads();
+	}
+
+	_threads = threads;
+	makeEvaluationPool();
+}
+
+void RefinementStrategy::setAsyncEvaluation(AsyncScore score, int inFlight)
+{
+	_evalPool = BatchEvaluatorPtr(new AsyncEvaluator(score, inFlight));
+}
+
+void RefinementStrategy::makeEvaluationPool()
+{
+	if (_threads <= 1 || _cloneFactory == NULL || _cloneScore == NULL)
+	{
+		/* a backend given by setEvaluationBackend() stays in place */
+		if (dynamic_cast<EvaluationPool *>(_evalPool.get()))
+		{
+			_evalPool = BatchEvaluatorPtr();
+		}
+
+		return;
+	}
+
+	_evalPool = EvaluationPoolPtr(new EvaluationPool(_threads, _cloneFactory,
+	                                                 _cloneScore, 
+	                                                 _cloneRelease));
+}
+
+void RefinementStrategy::setScoreCache(size_t entries)
+{
+	_cache = ScoreCachePtr();
+
+	if (entries > 0)
+	{
+		_cache = ScoreCachePtr(new ScoreCache(entries));
+	}
+}
+
+void RefinementStrategy::resetScoreCache()
+{
+	if (!_cache.get())
+	{
+		return;
+	}
+
+	std::vector<double> quanta;
+
+	for (size_t i = 0; i < parameterCount(); i++)
+	{
+		quanta.push_back(fabs(_params.otherValue(i)) * 1e-3);
+	}
+
+	_cache->setQuanta(quanta);
+}
+
+double RefinementStrategy::evaluateScore()
+{
+	if (!_cache.get())
+	{
+		return uncachedScore();
+	}
+
+	size_t n = parameterCount();
+	_pointScratch.resize(n);
+
+	for (size_t j = 0; j < n; j++)
+	{
+		_pointScratch[j] = getValueForParam(j);
+	}
+
+	double score = 0;
+	if (_cache->find(&_pointScratch[0], &score))
+	{
+		return score;
+	}
+
+	score = uncachedScore();
+	_cache->store(&_pointScratch[0], score);
+
+	return score;
+}
+
+double RefinementStrategy::uncachedScore()
+{
+	_evalCount++;
+	flushRefresh();
+
+	if (_terms.size())
+	{
+		return termScore();
+	}
+
+	return (*evaluationFunction)(evaluateObject);
+}
+
+int RefinementStrategy::addTerm(void *object, Getter getter)
+{
+	ScoreTerm term;
+	term.object = object;
+	term.getter = getter;
+	_terms.push_back(term);
+	_termValues.push_back(0);
+	_termDirty.push_back(0);
+	_allTermsDirty = true;
+
+	return _terms.size() - 1;
+}
+
+void RefinementStrategy::addTermForParam(int i, int term)
+{
+	if (i < 0 || i >= (int)parameterCount() || 
+	    term < 0 || term >= (int)_terms.size())
+	{
+		return;
+	}
+
+	_params.terms(i).push_back(term);
+}
+
+void RefinementStrategy::clearTerms()
+{
+	_terms.clear();
+	_termValues.clear();
+	_termDirty.clear();
+	_dirtyTerms.clear();
+	_allTermsDirty = true;
+
+	for (size_t i = 0; i < parameterCount(); i++)
+	{
+		_params.terms(i).clear();
+	}
+}
+
+void RefinementStrategy::markTermsDirty(int i)
+{
+	std::vector<int> &terms = _params.terms(i);
+
+	if (terms.size() == 0)
+	{
+		_allTermsDirty = true;
+		return;
+	}
+
+	for (size_t j = 0; j < terms.size(); j++)
+	{
+		int t = terms[j];
+
+		if (!_termDirty[t])
+		{
+			_termDirty[t] = 1;
+			_dirtyTerms.push_back(t);
+		}
+	}
+}
+
+void RefinementStrategy::sumTerms()
+{
+	_termTotal = 0;
+
+	for (size_t t = 0; t < _termValues.size(); t++)
+	{
+		_termTotal += _termValues[t];
+	}
+
+	_termUpdates = 0;
+}
+
+double RefinementStrategy::termScore()
+{
+	if (_allTermsDirty)
+	{
+		for (size_t t = 0; t < _terms.size(); t++)
+		{
+			_termValues[t] = (*_terms[t].getter)(_terms[t].object);
+			_termDirty[t] = 0;
+		}
+
+		_termEvaluations += _terms.size();
+		_dirtyTerms.clear();
+		_allTermsDirty = false;
+		sumTerms();
+
+		return _termTotal;
+	}
+
+	for (size_t j = 0; j < _dirtyTerms.size(); j++)
+	{
+		int t = _dirtyTerms[j];
+		double value = (*_terms[t].getter)(_terms[t].object);
+		_termTotal += value - _termValues[t];
+		_termValues[t] = value;
+		_termDirty[t] = 0;
+	}
+
+	_termEvaluations += _dirtyTerms.size();
+	_termUpdates += _dirtyTerms.size();
+	_dirtyTerms.clear();
+
+	/* start the total afresh now and then, so that rounding errors
+	 * cannot pile up, and whenever a NaN or infinity has passed through */
+	if (_termUpdates > _terms.size() || _termTotal != _termTotal)
+	{
+		sumTerms();
+	}
+
+	return _termTotal;
+}
+
+void RefinementStrategy::evaluateIndexed(size_t count, const PointFill &fill,
+                                         double *scores)
+{
+	size_t n = parameterCount();
+
+	if (parallelEvaluation())
+	{
+		if (!_evalPool->hasClones())
+		{
+			flushRefresh();
+			_evalPool->makeClones(evaluateObject);
+		}
+
+		if (!_cache.get())
+		{
+			_evalPool->evaluate(count, n, fill, scores);
+			_evalCount += count;
+			return;
+		}
+
+		/* look every point up here, and send only the new ones out */
+		_cacheMisses.clear();
+		_cachePoints.resize(count * n);
+
+		for (size_t i = 0; i < count; i++)
+		{
+			double *vals = &_cachePoints[_cacheMisses.size() * n];
+			fill(i, vals);
+
+			if (!_cache->find(vals, &scores[i]))
+			{
+				_cacheMisses.push_back(i);
+			}
+		}
+
+		size_t misses = _cacheMisses.size();
+		_cacheScores.resize(misses);
+
+		if (misses > 0)
+		{
+			_evalPool->evaluate(misses, n, [this, n](size_t idx, double *vals)
+			{
+				std::copy(&_cachePoints[idx * n], &_cachePoints[idx * n] + n,
+				          vals);
+			}, &_cacheScores[0]);
+		}
+
+		for (size_t i = 0; i < misses; i++)
+		{
+			scores[_cacheMisses[i]] = _cacheScores[i];
+
+			/* a backend reports a failed point (such as a dead worker
+			 * process) as NaN; it may score fine when asked again */
+			if (std::isfinite(_cacheScores[i]))
+			{
+				_cache->store(&_cachePoints[i * n], _cacheScores[i]);
+			}
+		}
+
+		_evalCount += misses;
+		return;
+	}
+
+	_pointScratch.resize(n);
+	double *vals = _pointScratch.data();
+
+	for (size_t i = 0; i < count; i++)
+	{
+		fill(i, vals);
+
+		if (_cache.get() && _cache->find(vals, &scores[i]))
+		{
+			continue;
+		}
+
+		setValuesForParams(vals);
+		scores[i] = uncachedScore();
+
+		if (_cache.get())
+		{
+			_cache->store(vals, scores[i]);
+		}
+	}
+}
+
+std::vector<double> RefinementStrategy::evaluateBatch(const 
+                                   std::vector<std::vector<double> > &points)
+{
+	std::vector<double> scores(points.size());
+	
+	if (points.size() == 0)
+	{
+		return scores;
+	}
+
+	size_t n = parameterCount();
+
+	evaluateIndexed(points.size(), [&](size_t idx, double *vals)
+	{
+		for (size_t j = 0; j < n; j++)
+		{
+			vals[j] = points[idx][j];
+		}
+	}, &scores[0]);
+
+	return scores;
 }
 
 void RefinementStrategy::addParameter(void *object, Getter getter, Setter setter, double stepSize, double otherValue, std::string tag, Getter gradient)
@@ -49,78 +405,223 @@ void RefinementStrategy::addParameter(void *object, Getter getter, Setter setter
 		return;
 	}
 
-	Parameter param;
-	param.object = object;
-	param.getter = getter;
-	param.gradient = gradient;
-	param.setter = setter;
-	param.step_size = stepSize;
-	param.other_value = otherValue;
+	_params.add(object, getter, setter, gradient, stepSize, otherValue, tag);
+}
+
+void RefinementStrategy::addParameter(double *value, double stepSize, 
+                                      double otherValue, std::string tag)
+{
+	if (value == NULL)
+	{
+		return;
+	}
+
+	_params.add(value, stepSize, otherValue, tag);
+}
 
-	if (!tag.length())
+void RefinementStrategy::setBlockSetter(size_t count, BlockSetter setter)
+{
+	if (count == 0 || count > parameterCount())
 	{
-		tag = "object" + i_to_str((int)parameterCount());
+		return;
 	}
 
-	param.tag = tag;
-	param.coupled = 1;
+	size_t first = parameterCount() - count;
 
-	_params.push_back(param);
+	for (size_t i = first; i < parameterCount(); i++)
+	{
+		if (_params.object(i) != _params.object(first))
+		{
+			*_stream << "Block setter given parameters of more than one "
+			"object, ignoring." << std::endl;
+			return;
+		}
+	}
+
+	for (size_t i = first; i < parameterCount(); i++)
+	{
+		_params.setBlock(i, setter, i - first, count);
+	}
+}
+
+void RefinementStrategy::findBlocks()
+{
+	_blocks.resize(parameterCount());
+
+	for (size_t i = 0; i < parameterCount(); i++)
+	{
+		int size = _params.blockSize(i);
+		bool whole = (_params.block(i) != NULL && _params.blockIndex(i) == 0 &&
+		              i + size <= parameterCount());
+
+		/* parameters since removed or shuffled break up a block */
+		for (int k = 1; k < size && whole; k++)
+		{
+			size_t j = i + k;
+			whole = (_params.block(j) == _params.block(i) && 
+			         _params.object(j) == _params.object(i) &&
+			         _params.blockIndex(j) == k && 
+			         _params.blockSize(j) == size);
+		}
+
+		_blocks[i] = (whole ? size : 0);
+	}
 }
 
 void RefinementStrategy::addCoupledParameter(void *object, Getter getter, Setter setter, double stepSize, double stepConvergence, std::string tag)
 {
 	int last = parameterCount() - 1;
-	_params[last].coupled++;
+	_params.coupled(last)++;
 	addParameter(object, getter, setter, stepSize, stepConvergence, tag);
-	_params[last + 1].coupled++;
+	_params.coupled(last + 1)++;
 }
 
-double RefinementStrategy::estimateGradientForParam(int i)
+double RefinementStrategy::shiftedScore(int i, double value)
 {
-	double curr = getValueForParam(i);
-	double step = _params[i].other_value;
-	double right = curr + step / 2;
-	setValueForParam(i, right);
-	double right_val;
-	
+	setValueForParam(i, value);
+
 	if (_partial == NULL)
 	{
-		right_val = (*evaluationFunction)(evaluateObject);
+		return evaluateScore();
 	}
-	else
+
+	flushRefresh();
+	return (*_partial)(evaluateObject, _params.object(i));
+}
+
+double RefinementStrategy::estimateGradientForParam(int i, double score)
+{
+	double curr = getValueForParam(i);
+	double step = _params.otherValue(i);
+
+	/* partial scores are always taken centrally, as the full score
+	 * cannot stand in for a partial one at the current point */
+	bool forward = (_gradMode == GradientForward && _partial == NULL);
+
+	if (forward && score != score)
 	{
-		right_val = (*_partial)(evaluateObject, _params[i].object);
+		score = evaluateScore();
 	}
 
-	double left = curr - step / 2;
-	setValueForParam(i, left);
-	double left_val;
-	if (_partial == NULL)
+	double right_val = shiftedScore(i, curr + step / 2);
+	double diff = 0;
+
+	if (forward)
 	{
-		left_val = (*evaluationFunction)(evaluateObject);
+		diff = (right_val - score) / (step / 2);
 	}
 	else
 	{
-		left_val = (*_partial)(evaluateObject, _params[i].object);
+		double left_val = shiftedScore(i, curr - step / 2);
+		diff = (right_val - left_val) / step;
 	}
-	
-	double diff = right_val - left_val;
-	diff /= step;
+
 	setValueForParam(i, curr);
 	
 	return diff;
 }
 
+void RefinementStrategy::calculateGradients(double *grads, double score)
+{
+	size_t n = parameterCount();
+	_gradParams.clear();
+
+	for (size_t i = 0; i < n; i++)
+	{
+		if (!_params.gradient(i))
+		{
+			_gradParams.push_back(i);
+		}
+	}
+
+	bool forward = (_gradMode == GradientForward);
+
+	/* without clones, shifting one parameter at a time costs far fewer
+	 * setter calls than applying every shifted point in full */
+	if (!parallelEvaluation())
+	{
+		if (forward && _partial == NULL && _gradParams.size() &&
+		    score != score)
+		{
+			score = evaluateScore();
+		}
+
+		for (size_t i = 0; i < n; i++)
+		{
+			if (_params.gradient(i))
+			{
+				grads[i] = getGradientForParam(i);
+			}
+			else
+			{
+				grads[i] = estimateGradientForParam(i, score);
+			}
+		}
+
+		return;
+	}
+
+	if (_gradParams.size())
+	{
+		_gradCentre.resize(n);
+		for (size_t i = 0; i < n; i++)
+		{
+			_gradCentre[i] = getValueForParam(i);
+		}
+
+		int sides = (forward ? 1 : 2);
+
+		if (forward && score != score)
+		{
+			score = evaluateScore();
+		}
+
+		/* all the shifted points are independent of one another */
+		_gradScores.resize(_gradParams.size() * sides);
+		evaluateIndexed(_gradScores.size(), 
+		                [this, sides, n](size_t idx, double *vals)
+		{
+			int p = _gradParams[idx / sides];
+			double shift = _params.otherValue(p) / 2;
+			std::copy(_gradCentre.begin(), _gradCentre.end(), vals);
+			vals[p] += (idx % sides == 0 ? shift : -shift);
+		}, &_gradScores[0]);
+
+		for (size_t j = 0; j < _gradParams.size(); j++)
+		{
+			int p = _gradParams[j];
+			double step = _params.otherValue(p);
+
+			if (forward)
+			{
+				grads[p] = (_gradScores[j] - score) / (step / 2);
+			}
+			else
+			{
+				grads[p] = (_gradScores[2 * j] - _gradScores[2 * j + 1]) / step;
+			}
+		}
+	}
+
+	for (size_t i = 0; i < n; i++)
+	{
+		if (_params.gradient(i))
+		{
+			grads[i] = getGradientForParam(i);
+		}
+	}
+}
+
 double RefinementStrategy::getGradientForParam(int i)
 {		
-	Getter gradient = _params[i].gradient;
+	Getter gradient = _params.gradient(i);
 	
 	if (!gradient)
 	{
 		return estimateGradientForParam(i);
 	}
-	void *object = _params[i].object;
+	void *object = _params.object(i);
+	flushRefresh();
 	double grad = (*gradient)(object);
 	
 	return grad;
@@ -128,8 +629,14 @@ double RefinementStrategy::getGradientForParam(int i)
 
 double RefinementStrategy::getValueForParam(int i)
 {
-	Getter getter = _params[i].getter;
-	void *object = _params[i].object;
+	double *direct = _params.direct(i);
+	if (direct)
+	{
+		return *direct;
+	}
+
+	Getter getter = _params.getter(i);
+	void *object = _params.object(i);
 	double objectValue = (*getter)(object);
 
 	return objectValue;
@@ -137,11 +644,53 @@ double RefinementStrategy::getValueForParam(int i)
 
 void RefinementStrategy::setValueForParam(int i, double value)
 {
-	Setter setter = _params[i].setter;
-	void *object = _params[i].object;
+	if (_terms.size() && !_allTermsDirty && value != getValueForParam(i))
+	{
+		markTermsDirty(i);
+	}
+
+	double *direct = _params.direct(i);
+	if (direct)
+	{
+		*direct = value;
+		return;
+	}
+
+	Setter setter = _params.setter(i);
+	void *object = _params.object(i);
 	(*setter)(object, value);
 }
 
+void RefinementStrategy::setValuesForParams(const double *vals)
+{
+	if (_blocks.size() != parameterCount())
+	{
+		findBlocks();
+	}
+
+	for (size_t i = 0; i < parameterCount(); i++)
+	{
+		int size = _blocks[i];
+
+		if (size == 0)
+		{
+			setValueForParam(i, vals[i]);
+			continue;
+		}
+
+		for (int k = 0; k < size && _terms.size() && !_allTermsDirty; k++)
+		{
+			if (vals[i + k] != getValueForParam(i + k))
+			{
+				markTermsDirty(i + k);
+			}
+		}
+
+		(*_params.block(i))(_params.object(i), &vals[i], size);
+		i += size - 1;
+	}
+}
+
 void RefinementStrategy::refine()
 {
 	if (!jobName.length())
@@ -152,28 +701,241 @@ void RefinementStrategy::refine()
 
 	if (parameterCount() == 0)
 	{
-		std::cout << " No parameters to refine! Exiting." << std::endl;
+		*_stream << " No parameters to refine! Exiting." << std::endl;
 		return;
 	}
 
 	if (evaluationFunction == NULL || evaluateObject == NULL)
 	{
-		std::cout << "Please set evaluation function and object." << std::endl;
+		*_stream << "Please set evaluation function and object." << std::endl;
 		return;
 	}
 
+	_evalCount = 0;
+	_lastCheckpoint = 0;
+	_termEvaluations = 0;
+	findBlocks();
+	_allTermsDirty = true;
+	resetScoreCache();
+	_refresh.setDeferring(true);
+	applyCheckpoint();
+	checkWarmStart();
+	flushRefresh();
+
+	if (parallelEvaluation())
+	{
+		/* clones must reflect the model as it is now */
+		_evalPool->makeClones(evaluateObject);
+	}
+
 	startingScore = (*evaluationFunction)(evaluateObject);
 	_prevScore = startingScore;
 
 	for (size_t i = 0; i < parameterCount(); i++)
 	{
 		double value = getValueForParam(i);
-		_params[i].start_value = value;
+		_params.startValue(i) = value;
+	}
+
+	if (_cache.get())
+	{
+		_pointScratch.resize(parameterCount());
+		for (size_t i = 0; i < parameterCount(); i++)
+		{
+			_pointScratch[i] = _params.startValue(i);
+		}
+
+		_cache->store(&_pointScratch[0], startingScore);
 	}
 
 	reportProgress(startingScore);
 }
 
+void RefinementStrategy::checkWarmStart()
+{
+	bool same = (_warmObjects.size() == parameterCount());
+
+	for (size_t i = 0; i < parameterCount() && same; i++)
+	{
+		same = (_warmObjects[i] == _params.object(i) &&
+		        _warmTags[i] == _params.tagId(i));
+	}
+
+	_warmValid = (_warm && same);
+	_warmObjects.clear();
+	_warmTags.clear();
+
+	if (!_warm)
+	{
+		return;
+	}
+
+	for (size_t i = 0; i < parameterCount(); i++)
+	{
+		_warmObjects.push_back(_params.object(i));
+		_warmTags.push_back(_params.tagId(i));
+	}
+}
+
+void RefinementStrategy::setCheckpoint(std::string filename, 
+                                       size_t interval)
+{
+	_checkpointFile = filename;
+	_checkpointInterval = interval;
+}
+
+void RefinementStrategy::checkpoint()
+{
+	if (!_checkpointFile.length() || 
+	    _evalCount - _lastCheckpoint < _checkpointInterval)
+	{
+		return;
+	}
+
+	writeCheckpoint();
+	_lastCheckpoint = _evalCount;
+}
+
+void RefinementStrategy::writeCheckpoint()
+{
+	std::string temp = _checkpointFile + ".part";
+	std::ofstream out(temp.c_str(), std::ios::out | std::ios::binary);
+
+	out.write(CHECKPOINT_MAGIC, 4);
+	writeBinary(out, (uint32_t)CHECKPOINT_VERSION);
+	writeBinaryString(out, typeid(*this).name());
+	writeBinary(out, (uint64_t)parameterCount());
+
+	for (size_t i = 0; i < parameterCount(); i++)
+	{
+		writeBinaryString(out, _params.tag(i));
+		writeBinary(out, _params.startValue(i));
+	}
+
+	writeBinary(out, (uint64_t)_evalCount);
+	writeState(out);
+	out.close();
+
+	if (out.fail() || std::rename(temp.c_str(), _checkpointFile.c_str()))
+	{
+		*_stream << "Could not write checkpoint " << _checkpointFile 
+		<< std::endl;
+	}
+}
+
+bool RefinementStrategy::resumeFrom(std::string filename)
+{
+	std::ifstream in(filename.c_str(), std::ios::in | std::ios::binary);
+	std::ostringstream contents;
+	contents << in.rdbuf();
+	_resumeData = contents.str();
+
+	if (_resumeData.compare(0, 4, CHECKPOINT_MAGIC) != 0)
+	{
+		_resumeData.clear();
+		return false;
+	}
+
+	return true;
+}
+
+void RefinementStrategy::applyCheckpoint()
+{
+	_resuming = false;
+
+	if (!_resumeData.length())
+	{
+		return;
+	}
+
+	std::istringstream in(_resumeData);
+	_resumeData.clear();
+	in.seekg(4);
+
+	uint32_t version = 0;
+	std::string type;
+	uint64_t count = 0;
+	bool ok = (readBinary(in, version) && version == CHECKPOINT_VERSION &&
+	           readBinaryString(in, type) && type == typeid(*this).name() &&
+	           readBinary(in, count) && count == parameterCount());
+
+	std::vector<double> starts(parameterCount());
+
+	for (size_t i = 0; i < parameterCount() && ok; i++)
+	{
+		std::string tag;
+		ok = (readBinaryString(in, tag) && tag == _params.tag(i) &&
+		      readBinary(in, starts[i]));
+	}
+
+	uint64_t evaluations = 0;
+	ok = ok && readBinary(in, evaluations);
+
+	if (!ok)
+	{
+		*_stream << "Checkpoint does not match " << jobName 
+		<< ", starting afresh." << std::endl;
+		return;
+	}
+
+	/* the model as it was when the interrupted refine() began */
+	setValuesForParams(&starts[0]);
+
+	_evalCount = evaluations;
+	_lastCheckpoint = evaluations;
+	_resumeData.assign(std::istreambuf_iterator<char>(in),
+	                   std::istreambuf_iterator<char>());
+	_resuming = true;
+}
+
+bool RefinementStrategy::resumeState()
+{
+	if (!_resuming)
+	{
+		return false;
+	}
+
+	std::istringstream in(_resumeData);
+	bool ok = readState(in);
+	_resumeData.clear();
+	_resuming = false;
+
+	if (!ok)
+	{
+		*_stream << "Could not read checkpoint state for " << jobName
+		<< ", starting afresh." << std::endl;
+	}
+
+	return ok;
+}
+
+void RefinementStrategy::storeWarmMoves()
+{
+	_warmMoves.clear();
+
+	for (size_t i = 0; i < parameterCount() && _warm; i++)
+	{
+		_warmMoves.push_back(getValueForParam(i) - _params.startValue(i));
+	}
+}
+
+double RefinementStrategy::warmStepForParam(int i)
+{
+	double step = _params.stepSize(i);
+
+	if (!_warmValid || _warmMoves.size() != parameterCount())
+	{
+		return step;
+	}
+
+	/* expect to move about as far, and the same way, as last time */
+	double move = _warmMoves[i];
+	double size = std::max(fabs(move), 2 * fabs(_params.otherValue(i)));
+	size = std::min(size, fabs(step));
+
+	return (move < 0 ? -size : size);
+}
+
 void RefinementStrategy::reportProgress(double score)
 {
 	if (!_verbose)
@@ -206,10 +968,15 @@ void RefinementStrategy::reportProgress(double score)
 
 void RefinementStrategy::finish()
 {
-	double endScore = (*evaluationFunction)(evaluateObject);
+	flushRefresh();
+
+	/* the final point has usually been scored already */
+	double endScore = (_cache.get() ? evaluateScore() :
+	                   (*evaluationFunction)(evaluateObject));
 	
 	if (!parameterCount())
 	{
+		_refresh.setDeferring(false);
 		return;
 	}
 	
@@ -228,13 +995,13 @@ void RefinementStrategy::finish()
 			for (size_t i = 0; i < parameterCount(); i++)
 			{
 				double value = getValueForParam(i);
-				_params[i].changed = 0;
-				*_stream << _params[i].tag << "=" << value * rad2degscale <<
+				_params.changed(i) = 0;
+				*_stream << _params.tag(i) << "=" << value * rad2degscale <<
 				(_toDegrees ? "º" : "") << ", ";
 			}
 
 			*_stream << " (" << startingScore << ") ";
-			_timer.quickReport();
+			_timer.quickReport(_stream);
 			*_stream << std::endl;
 		}
 	}
@@ -258,17 +1025,17 @@ void RefinementStrategy::finish()
 			for (size_t i = 0; i < parameterCount(); i++)
 			{
 				double value = getValueForParam(i);
-				double start = _params[i].start_value;
+				double start = _params.startValue(i);
 				
-				_params[i].changed = (fabs(start - value) > 1e-4);
+				_params.changed(i) = (fabs(start - value) > 1e-4);
 				
-				*_stream << _params[i].tag << "=" << value * rad2degscale <<
+				*_stream << _params.tag(i) << "=" << value * rad2degscale <<
 				(_toDegrees ? "°" : "") << ", ";
 			}
 
 			*_stream << "(" << startingScore << " to " << 
 			endScore << ") ";
-			_timer.quickReport();
+			_timer.quickReport(_stream);
 			*_stream << std::endl;
 		}
 
@@ -278,6 +1045,18 @@ void RefinementStrategy::finish()
 	}
 
 	cycleNum = 0;
+	storeWarmMoves();
+	_refresh.setDeferring(false);
+
+	if (_checkpointFile.length())
+	{
+		std::remove(_checkpointFile.c_str());
+	}
+
+	if (parallelEvaluation())
+	{
+		_evalPool->releaseClones();
+	}
 
 	if (finishFunction != NULL)
 	{
@@ -287,11 +1066,19 @@ void RefinementStrategy::finish()
 
 void RefinementStrategy::resetToInitialParameters()
 {
+	if (!parameterCount())
+	{
+		return;
+	}
+
+	_valueScratch.resize(parameterCount());
+
 	for (size_t i = 0; i < parameterCount(); i++)
 	{
-		double value = _params[i].start_value;
-		setValueForParam(i, value);
+		_valueScratch[i] = _params.startValue(i);
 	}
+
+	setValuesForParams(&_valueScratch[0]);
 }
 
 void RefinementStrategy::reportResult()
@@ -316,11 +1103,10 @@ void RefinementStrategy::findIfSignificant()
 
 	for (size_t i = 0; i < parameterCount(); i++)
 	{
-		Parameter p = getParamObject(i);
-		double now = (*p.getter)(p.object);
-		double change = fabs(now - p.start_value);
+		double now = getValueForParam(i);
+		double change = fabs(now - _params.startValue(i));
 		
-		if (change > p.other_value * 2)
+		if (change > _params.otherValue(i) * 2)
 		{
 			_enough = true;
 		}
@@ -330,7 +1116,12 @@ void RefinementStrategy::findIfSignificant()
 
 void RefinementStrategy::outputStream()
 {
-	std::ostringstream *o = static_cast<std::ostringstream *>(_stream);
+	std::ostringstream *o = dynamic_cast<std::ostringstream *>(_stream);
+	if (o == NULL)
+	{
+		return;
+	}
+
 	std::cout << o->str();
 	o->str("");
 }
@@ -29,6 +29,12 @@
 #include <vector>
 #include <cmath>
 #include "Timer.h"
+#include "EvaluationPool.h"
+#include "AsyncEvaluator.h"
+#include "ScoreCache.h"
+#include "RefreshQueue.h"
+#include "ParameterTable.h"
+#include <boost/shared_ptr.hpp>
 
 typedef enum
 {
@@ -37,25 +43,21 @@ typedef enum
 	MinimizationMethodGridSearch = 2,
 } MinimizationMethod;
 
+typedef enum
+{
+	GradientCentral = 0,
+	GradientForward = 1,
+} GradientMode;
+
 typedef void (*TwoDouble)(void *, double value1, double value2);
 
-typedef double (*Getter)(void *);
 typedef double (*PartialScore)(void *, void *);
-typedef void (*Setter)(void *, double newValue);
 
 typedef struct
 {
 	void *object;
 	Getter getter;
-	Getter gradient;
-	Setter setter;
-	double step_size;
-	double other_value;
-	double start_value;
-	std::string tag;
-	int coupled;
-	int changed;
-} Parameter;
+} ScoreTerm;
 
 /** \class RefinementStrategy
  *  \brief Abstract class upon which target function optimisers can be built. 
@@ -72,7 +74,13 @@ public:
 	{
 		_stream = other;
 	}
+
+	std::ostream *stream()
+	{
+		return _stream;
+	}
 	
+	/* writes out and empties the stream, if it is an ostringstream */
 	void outputStream();
 
 	virtual ~RefinementStrategy() {};
@@ -96,12 +104,177 @@ public:
 	                         double stepSize, double otherValue, 
 	                         std::string tag = "");
 
+	/* binds the parameter straight to a double, which is then read and
+	 * written in place with no call through a getter or setter */
+	void addParameter(double *value, double stepSize, double otherValue, 
+	                  std::string tag = "");
+
+	template <class T>
+	void addParameter(T *object, double T::*member, double stepSize, 
+	                  double otherValue, std::string tag = "")
+	{
+		if (object != NULL)
+		{
+			addParameter(&(object->*member), stepSize, otherValue, tag);
+		}
+	}
+
+	/* type-safe getter and setter members, with no static wrappers, e.g.
+	 * addParameter<Atom, &Atom::getBFactor, &Atom::setBFactor>(atom, ...) */
+	template <class T, double (T::*get)(), void (T::*set)(double)>
+	void addParameter(T *object, double stepSize, double otherValue, 
+	                  std::string tag = "")
+	{
+		addParameter(object, &bound_getter<T, get>, &bound_setter<T, set>,
+		             stepSize, otherValue, tag);
+	}
+
+	template <class T, double (T::*get)() const, void (T::*set)(double)>
+	void addParameter(T *object, double stepSize, double otherValue, 
+	                  std::string tag = "")
+	{
+		addParameter(object, &bound_const_getter<T, get>, 
+		             &bound_setter<T, set>, stepSize, otherValue, tag);
+	}
+
+	/* the last count parameters added, which must share one object,
+	 * may be set in a single call to setter with all their values, in
+	 * the order they were added. Moving to a new point then costs one
+	 * call and one refresh of the object instead of count of each. */
+	void setBlockSetter(size_t count, BlockSetter setter);
+
+	/* defers refreshes from objects attached to it (see Any and
+	 * RefineMat3x3) for the length of refine(), running each of them once
+	 * before the model is next scored or read */
+	RefreshQueue *refreshQueue()
+	{
+		return &_refresh;
+	}
+
 	void setEvaluationFunction(Getter function, void *evaluatedObject)
 	{
 		evaluationFunction = function;
 		evaluateObject = evaluatedObject;
 	}
 
+	/* For parallel evaluation: factory makes one clone of the evaluated
+	 * object for each worker thread, and score applies a whole parameter
+	 * vector (in the order parameters were added) to a clone and
+	 * returns its evaluation. */
+	void setCloneFunctions(CloneFactory factory, VectorScore score,
+	                       CloneRelease release = NULL);
+	
+	/* number of worker threads for batch evaluation, zero or less for
+	 * one per hardware thread. Only used once clone functions are set. */
+	void setThreads(int threads);
+
+	/* scores batches with the given backend instead, such as a
+	 * ProcessPool for objectives which are not thread-safe. Replaced
+	 * only if clone functions and more than one thread later set up a
+	 * thread pool. */
+	void setEvaluationBackend(BatchEvaluatorPtr backend)
+	{
+		_evalPool = backend;
+	}
+
+	/* scores batches through an objective returning futures, with up to
+	 * inFlight points outstanding at once; see AsyncEvaluator */
+	void setAsyncEvaluation(AsyncScore score, int inFlight);
+
+	bool parallelEvaluation()
+	{
+		return (_evalPool.get() != NULL);
+	}
+
+	/* scores each of the parameter vectors, concurrently if clone
+	 * functions and threads have been set up, otherwise one after another
+	 * on the evaluated object. Parameters are left in an unspecified
+	 * state afterwards. */
+	std::vector<double> evaluateBatch(const std::vector<std::vector<double> >
+	                                  &points);
+
+	/* how gradients are estimated for parameters without a gradient
+	 * getter: central differences cost two evaluations per parameter,
+	 * forward differences one, reusing the score at the current point.
+	 * Partial scores are always taken by central differences. */
+	void setGradientMode(GradientMode mode)
+	{
+		_gradMode = mode;
+	}
+
+	/* keeps what was learned in one refine() for the next, provided the
+	 * same parameters (objects and tags, in order) are being refined:
+	 * first steps are sized by how far each parameter moved last time,
+	 * and L-BFGS keeps its curvature pairs */
+	void setWarmStart(bool warm = true)
+	{
+		_warm = warm;
+	}
+
+	/* every interval evaluations, at the next point from which the
+	 * minimiser can carry on, its state is written to filename. A
+	 * temporary file is renamed over it, so a job killed while writing
+	 * leaves the previous checkpoint intact. A refine() which finishes
+	 * removes its checkpoint. An empty filename stops checkpointing. */
+	void setCheckpoint(std::string filename, size_t interval);
+	
+	/* the next refine() carries on from this checkpoint file instead of
+	 * starting afresh, if it was written by the same kind of strategy
+	 * for the same parameters (by tag). Returns false if the file cannot
+	 * be read as a checkpoint at all. */
+	bool resumeFrom(std::string filename);
+	
+	/* evaluations made by the latest refine() */
+	size_t evaluationCount()
+	{
+		return _evalCount;
+	}
+
+	/* remembers the scores of up to entries points during each refine(),
+	 * so that revisiting a point costs no evaluation. Each parameter is
+	 * rounded to a multiple of a thousandth of its |other_value|, and
+	 * points which round to the same multiples share a score. Only for
+	 * evaluation functions which depend on nothing but the parameters.
+	 * Zero entries turns it off. */
+	void setScoreCache(size_t entries);
+	
+	/* cached scores reused, and looked up in vain, by the latest
+	 * refine() */
+	size_t cacheHits()
+	{
+		return (_cache.get() ? _cache->hits() : 0);
+	}
+
+	size_t cacheMisses()
+	{
+		return (_cache.get() ? _cache->misses() : 0);
+	}
+
+	/* declares that the score is a sum of terms, each term being
+	 * getter(object). Within refine(), an evaluation then recalculates
+	 * only the terms affected by parameters which have changed since
+	 * the last one, and adds the differences to a running total. The
+	 * evaluation function must still be set and give the same sum.
+	 * Returns the index of the new term. */
+	int addTerm(void *object, Getter getter);
+
+	/* parameter i changes term, and no terms but those declared. A
+	 * parameter with no declared terms may change any of them. */
+	void addTermForParam(int i, int term);
+
+	void clearTerms();
+
+	size_t termCount()
+	{
+		return _terms.size();
+	}
+	
+	/* single terms calculated by the latest refine() */
+	size_t termEvaluations()
+	{
+		return _termEvaluations;
+	}
+
 	void setPartialEvaluation(PartialScore function)
 	{
 		_partial = function;
@@ -163,29 +336,30 @@ public:
 		return _params.size();
 	}
 	
+	/* a copy; use parameterTable() to change a parameter in place */
 	Parameter getParamObject(int i)
 	{
-		return _params[i];
+		return _params.parameter(i);
 	}
 	
-	Parameter *getParamPtr(int i)
+	ParameterTable &parameterTable()
 	{
-		return &_params[i];
+		return _params;
 	}
 	
 	void removeParameter(int i)
 	{
-		_params.erase(_params.begin() + i);
+		_params.erase(i);
 	}
 	
 	void addParameter(Parameter &param)
 	{
-		_params.push_back(param);
+		_params.add(param);
 	}
 	
 	bool didChange(int i)
 	{
-		return _params[i].changed;
+		return _params.changed(i);
 	}
 
 	double improvement()
@@ -203,6 +377,7 @@ protected:
 	Getter evaluationFunction;
 	Getter finishFunction;
 	PartialScore _partial;
+	GradientMode _gradMode;
 	int maxCycles;
 	void *evaluateObject;
 	std::string jobName;
@@ -213,22 +388,117 @@ protected:
 	bool _silent;
 	double _improvement;
 
-	std::vector<Parameter> _params;
+	ParameterTable _params;
 	double startingScore;
 	double _prevScore;
 	bool _verbose;
 	bool _enough;
 
+	/* warm start asked for, and state from last time may be used */
+	bool _warm;
+	bool _warmValid;
+	
+	size_t _evalCount;
+
+	/* scores the parameters as they stand, from the cache if it has
+	 * seen them before */
+	double evaluateScore();
+	
+	/* writes a checkpoint if enough evaluations have passed since the
+	 * last one; call only where writeState() would save a state which
+	 * readState() can carry on from */
+	void checkpoint();
+
+	bool checkpointing()
+	{
+		return (_checkpointFile.length() > 0);
+	}
+
+	/* state of the subclass, which follows the parameter values at the
+	 * start of refine() in the checkpoint file. readState() should
+	 * leave the strategy untouched if it returns false. */
+	virtual void writeState(std::ostream &) {}
+	virtual bool readState(std::istream &) { return true; }
+	
+	/* if this refine() is resuming a checkpoint, calls readState() on it
+	 * and returns its verdict; otherwise returns false */
+	bool resumeState();
+
+	void evaluateIndexed(size_t count, const PointFill &fill, double *scores);
 	void findIfSignificant();
 	double getGradientForParam(int i);
-	double estimateGradientForParam(int i);
+	double shiftedScore(int i, double value);
+
+	/* score is the current full score for forward differences, or NaN
+	 * for it to be evaluated here */
+	double estimateGradientForParam(int i, double score = NAN);
+	void calculateGradients(double *grads, double score);
 	double getValueForParam(int i);
+	double warmStepForParam(int i);
 	void setValueForParam(int i, double value);
+	
+	/* sets every parameter, using block setters where they apply */
+	void setValuesForParams(const double *vals);
 	void reportProgress(double score);
 	void finish();
 
+	/* call before anything but a setter touches the model */
+	void flushRefresh()
+	{
+		_refresh.flush();
+	}
+
 	std::ostream *_stream;
 	Timer _timer;
+private:
+	void makeEvaluationPool();
+	void checkWarmStart();
+	void storeWarmMoves();
+	void writeCheckpoint();
+	void applyCheckpoint();
+	void resetScoreCache();
+	double uncachedScore();
+	void markTermsDirty(int i);
+	double termScore();
+	void sumTerms();
+	void findBlocks();
+
+	CloneFactory _cloneFactory;
+	VectorScore _cloneScore;
+	CloneRelease _cloneRelease;
+	int _threads;
+	BatchEvaluatorPtr _evalPool;
+	RefreshQueue _refresh;
+	std::vector<double> _pointScratch;
+	std::vector<double> _valueScratch;
+	std::vector<int> _blocks;
+	ScoreCachePtr _cache;
+	std::vector<size_t> _cacheMisses;
+	std::vector<double> _cachePoints;
+	std::vector<double> _cacheScores;
+
+	std::vector<ScoreTerm> _terms;
+	std::vector<double> _termValues;
+	std::vector<char> _termDirty;
+	std::vector<int> _dirtyTerms;
+	bool _allTermsDirty;
+	double _termTotal;
+	size_t _termUpdates;
+	size_t _termEvaluations;
+	std::vector<double> _gradCentre;
+	std::vector<double> _gradScores;
+	std::vector<int> _gradParams;
+	std::vector<void *> _warmObjects;
+	std::vector<long> _warmTags;
+	std::vector<double> _warmMoves;
+	
+	std::string _checkpointFile;
+	size_t _checkpointInterval;
+	size_t _lastCheckpoint;
+	std::string _resumeData;
+	bool _resuming;
 };
 
+typedef boost::shared_ptr<RefinementStrategy> RefinementStrategyPtr;
+
 #endif /* defined(__vagabond__RefinementStrategy__) */
@@ -0,0 +1,67 @@
+// Vagabond
+// Copyright (C) 2019 Helen Ginn
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+// Please email: vagabond @ hginn.co.uk for more details.
+
+#include "RefreshQueue.h"
+#include <cstddef>
+
+void RefreshQueue::mark(RefreshCall call, void *object)
+{
+	if (call == NULL)
+	{
+		return;
+	}
+
+	if (!_deferring)
+	{
+		(*call)(object);
+		return;
+	}
+
+	/* usually only a handful of parents, so a plain search will do */
+	for (size_t i = 0; i < _waiting.size(); i++)
+	{
+		if (_waiting[i].first == call && _waiting[i].second == object)
+		{
+			return;
+		}
+	}
+
+	_waiting.push_back(std::make_pair(call, object));
+}
+
+void RefreshQueue::flush()
+{
+	/* callbacks marked during the flush are run by it as well */
+	for (size_t i = 0; i < _waiting.size(); i++)
+	{
+		Waiting w = _waiting[i];
+		(*w.first)(w.second);
+	}
+
+	_waiting.clear();
+}
+
+void RefreshQueue::setDeferring(bool defer)
+{
+	if (!defer)
+	{
+		flush();
+	}
+
+	_deferring = defer;
+}
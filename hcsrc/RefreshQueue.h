@@ -0,0 +1,63 @@
+// Vagabond
+// Copyright (C) 2019 Helen Ginn
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+// Please email: vagabond @ hginn.co.uk for more details.
+
+#ifndef __vagabond__RefreshQueue__
+#define __vagabond__RefreshQueue__
+
+#include <vector>
+
+typedef void (*RefreshCall)(void *);
+
+/** \class RefreshQueue
+ *  \brief Collects refresh callbacks from parameter setters while
+ *  deferring, so that each one runs once when the queue is flushed.
+ *
+ *  While not deferring, mark() runs the callback straight away, so
+ *  objects attached to a queue behave as before outside refinement.
+ **/
+
+class RefreshQueue
+{
+public:
+	RefreshQueue()
+	{
+		_deferring = false;
+	}
+
+	/* runs call(object) now, or at the next flush if deferring and
+	 * not already waiting */
+	void mark(RefreshCall call, void *object);
+
+	/* runs every waiting callback once, in the order first marked */
+	void flush();
+
+	/* stopping deferral flushes anything still waiting */
+	void setDeferring(bool defer);
+
+	bool deferring()
+	{
+		return _deferring;
+	}
+private:
+	typedef std::pair<RefreshCall, void *> Waiting;
+
+	bool _deferring;
+	std::vector<Waiting> _waiting;
+};
+
+#endif
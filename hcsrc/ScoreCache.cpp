@@ -0,0 +1,113 @@
+// Vagabond
+// Copyright (C) 2019 Helen Ginn
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+// Please email: vagabond @ hginn.co.uk for more details.
+
+#include "ScoreCache.h"
+#include <string.h>
+#include <cmath>
+
+ScoreCache::ScoreCache(size_t capacity)
+{
+	_capacity = (capacity > 0 ? capacity : 1);
+	_hits = 0;
+	_misses = 0;
+}
+
+size_t ScoreCache::KeyHash::operator()(const Key &key) const
+{
+	/* FNV-1a over the rounded values */
+	uint64_t hash = 14695981039346656037ULL;
+
+	for (size_t i = 0; i < key.size(); i++)
+	{
+		hash ^= (uint64_t)key[i];
+		hash *= 1099511628211ULL;
+	}
+
+	return (size_t)hash;
+}
+
+void ScoreCache::setQuanta(const std::vector<double> &quanta)
+{
+	_quanta = quanta;
+	clear();
+}
+
+void ScoreCache::clear()
+{
+	_entries.clear();
+	_lookup.clear();
+	_hits = 0;
+	_misses = 0;
+}
+
+void ScoreCache::makeKey(const double *vals)
+{
+	_key.resize(_quanta.size());
+
+	for (size_t i = 0; i < _quanta.size(); i++)
+	{
+		if (_quanta[i] > 0)
+		{
+			_key[i] = llround(vals[i] / _quanta[i]);
+		}
+		else
+		{
+			memcpy(&_key[i], &vals[i], sizeof(double));
+		}
+	}
+}
+
+bool ScoreCache::find(const double *vals, double *score)
+{
+	makeKey(vals);
+	KeyMap::iterator it = _lookup.find(_key);
+
+	if (it == _lookup.end())
+	{
+		_misses++;
+		return false;
+	}
+
+	_entries.splice(_entries.begin(), _entries, it->second);
+	*score = it->second->second;
+	_hits++;
+
+	return true;
+}
+
+void ScoreCache::store(const double *vals, double score)
+{
+	makeKey(vals);
+	KeyMap::iterator it = _lookup.find(_key);
+
+	if (it != _lookup.end())
+	{
+		it->second->second = score;
+		_entries.splice(_entries.begin(), _entries, it->second);
+		return;
+	}
+
+	_entries.push_front(std::make_pair(_key, score));
+	_lookup[_key] = _entries.begin();
+
+	if (_entries.size() > _capacity)
+	{
+		_lookup.erase(_entries.back().first);
+		_entries.pop_back();
+	}
+}
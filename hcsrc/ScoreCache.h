@@ -0,0 +1,97 @@
+// Vagabond
+// Copyright (C) 2019 Helen Ginn
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+// Please email: vagabond @ hginn.co.uk for more details.
+
+#ifndef __vagabond__ScoreCache__
+#define __vagabond__ScoreCache__
+
+#include <stdint.h>
+#include <list>
+#include <vector>
+#include <unordered_map>
+#include <boost/shared_ptr.hpp>
+
+/** \class ScoreCache
+ *  \brief Remembers the scores of recently evaluated parameter vectors,
+ *  dropping the least recently used once full.
+ *
+ *  Each value is rounded to the nearest multiple of the quantum for its
+ *  parameter before lookup, and points which round to the same multiples
+ *  share a score. Points closer than one quantum may still round apart.
+ *  A quantum of zero only matches exactly equal values.
+ **/
+
+class ScoreCache
+{
+public:
+	ScoreCache(size_t capacity);
+
+	/* one quantum per parameter; throws away all stored scores */
+	void setQuanta(const std::vector<double> &quanta);
+	void clear();
+
+	/* true, with the score filled in, if vals has been stored */
+	bool find(const double *vals, double *score);
+	void store(const double *vals, double score);
+
+	size_t capacity()
+	{
+		return _capacity;
+	}
+
+	size_t size()
+	{
+		return _entries.size();
+	}
+
+	size_t hits()
+	{
+		return _hits;
+	}
+
+	size_t misses()
+	{
+		return _misses;
+	}
+private:
+	typedef std::vector<int64_t> Key;
+	typedef std::pair<Key, double> Entry;
+	typedef std::list<Entry> EntryList;
+
+	struct KeyHash
+	{
+		size_t operator()(const Key &key) const;
+	};
+
+	typedef std::unordered_map<Key, EntryList::iterator, KeyHash> KeyMap;
+
+	void makeKey(const double *vals);
+
+	size_t _capacity;
+	size_t _hits;
+	size_t _misses;
+	std::vector<double> _quanta;
+
+	/* most recently used at the front */
+	EntryList _entries;
+	KeyMap _lookup;
+	Key _key;
+};
+
+typedef boost::shared_ptr<ScoreCache> ScoreCachePtr;
+
+#endif
@@ -0,0 +1,110 @@
+// Vagabond
+// Copyright (C) 2019 Helen Ginn
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+// Please email: vagabond @ hginn.co.uk for more details.
+
+#include "SumObjective.h"
+#include <algorithm>
+
+SumObjective::SumObjective()
+{
+	_chunkSize = 256;
+}
+
+int SumObjective::addTerm(void *object, Getter term, double weight)
+{
+	ScoreTerm t;
+	t.object = object;
+	t.getter = term;
+	_terms.push_back(t);
+	_weights.push_back(weight);
+
+	return _terms.size() - 1;
+}
+
+void SumObjective::clearTerms()
+{
+	_terms.clear();
+	_weights.clear();
+}
+
+void SumObjective::setThreads(int threads)
+{
+	if (threads <= 0)
+	{
+		threads = ThreadPool::hardwareThreads();
+	}
+
+	_pool = boost::shared_ptr<ThreadPool>();
+
+	if (threads > 1)
+	{
+		_pool = boost::shared_ptr<ThreadPool>(new ThreadPool(threads));
+	}
+}
+
+void SumObjective::setChunkSize(size_t size)
+{
+	_chunkSize = (size > 0 ? size : 1);
+}
+
+double SumObjective::sumChunk(size_t chunk)
+{
+	size_t end = std::min(_terms.size(), (chunk + 1) * _chunkSize);
+	double sum = 0;
+
+	for (size_t i = chunk * _chunkSize; i < end; i++)
+	{
+		if (_weights[i] == 0)
+		{
+			continue;
+		}
+
+		sum += _weights[i] * (*_terms[i].getter)(_terms[i].object);
+	}
+
+	return sum;
+}
+
+double SumObjective::evaluate()
+{
+	size_t chunks = (_terms.size() + _chunkSize - 1) / _chunkSize;
+	_partials.resize(chunks);
+
+	if (chunks <= 1 || !_pool)
+	{
+		for (size_t i = 0; i < chunks; i++)
+		{
+			_partials[i] = sumChunk(i);
+		}
+	}
+	else
+	{
+		_pool->run(chunks, [this](size_t i, int)
+		{
+			_partials[i] = sumChunk(i);
+		});
+	}
+
+	double total = 0;
+
+	for (size_t i = 0; i < chunks; i++)
+	{
+		total += _partials[i];
+	}
+
+	return total;
+}
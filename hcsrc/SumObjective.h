@@ -0,0 +1,94 @@
+// Vagabond
+// Copyright (C) 2019 Helen Ginn
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+// Please email: vagabond @ hginn.co.uk for more details.
+
+#ifndef __vagabond__SumObjective__
+#define __vagabond__SumObjective__
+
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include "RefinementStrategy.h"
+#include "ThreadPool.h"
+
+/** \class SumObjective
+ *  \brief A target function which is a weighted sum of many independent
+ *  terms, evaluated in chunks spread over a pool of threads.
+ *
+ *  Terms are summed in order within fixed-size chunks, then the chunk
+ *  sums are added in order, so the result is exactly the same however
+ *  many threads are used. Term getters may be called concurrently and
+ *  must not change anything which another term reads.
+ *
+ *  To refine against it:
+ *  strategy->setEvaluationFunction(SumObjective::score, &objective);
+ **/
+
+class SumObjective
+{
+public:
+	SumObjective();
+
+	/* returns the index of the new term */
+	int addTerm(void *object, Getter term, double weight = 1);
+
+	/* a term with zero weight is not calculated at all */
+	void setWeight(int i, double weight)
+	{
+		_weights[i] = weight;
+	}
+
+	double weight(int i)
+	{
+		return _weights[i];
+	}
+
+	size_t termCount()
+	{
+		return _terms.size();
+	}
+
+	void clearTerms();
+
+	/* zero or less for one per hardware thread */
+	void setThreads(int threads);
+
+	/* number of terms summed together by one thread; changing it may
+	 * change the result in the last few bits */
+	void setChunkSize(size_t size);
+
+	/* not to be called from two threads at once */
+	double evaluate();
+
+	/* Getter for RefinementStrategy::setEvaluationFunction, with the
+	 * SumObjective itself as the evaluated object */
+	static double score(void *object)
+	{
+		return static_cast<SumObjective *>(object)->evaluate();
+	}
+private:
+	double sumChunk(size_t chunk);
+
+	std::vector<ScoreTerm> _terms;
+	std::vector<double> _weights;
+	std::vector<double> _partials;
+	size_t _chunkSize;
+	boost::shared_ptr<ThreadPool> _pool;
+};
+
+typedef boost::shared_ptr<SumObjective> SumObjectivePtr;
+
+#endif
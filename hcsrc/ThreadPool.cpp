@@ -0,0 +1,159 @@
+// Vagabond
+// Copyright (C) 2019 Helen Ginn
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+// Please email: vagabond @ hginn.co.uk for more details.
+
+#include "ThreadPool.h"
+
+/* pool which owns the current thread, if any */
+static thread_local ThreadPool *_currentPool = NULL;
+
+ThreadPool::ThreadPool(int threads)
+{
+	_job = NULL;
+	_count = 0;
+	_next = 0;
+	_busy = 0;
+	_generation = 0;
+	_quit = false;
+
+	if (threads <= 0)
+	{
+		threads = hardwareThreads();
+	}
+
+	for (int i = 0; i < threads; i++)
+	{
+		_threads.push_back(std::thread(&ThreadPool::work, this, i));
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_quit = true;
+	}
+
+	_wake.notify_all();
+
+	for (size_t i = 0; i < _threads.size(); i++)
+	{
+		_threads[i].join();
+	}
+}
+
+int ThreadPool::hardwareThreads()
+{
+	int n = std::thread::hardware_concurrency();
+	return (n > 0 ? n : 1);
+}
+
+void ThreadPool::work(int worker)
+{
+	_currentPool = this;
+	unsigned long seen = 0;
+
+	while (true)
+	{
+		const PoolJob *job = NULL;
+		size_t count = 0;
+
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_wake.wait(lock, [&] { return _quit || _generation != seen; });
+
+			if (_quit)
+			{
+				return;
+			}
+
+			seen = _generation;
+			job = _job;
+			count = _count;
+		}
+
+		std::exception_ptr error;
+
+		for (size_t i = _next++; i < count; i = _next++)
+		{
+			try
+			{
+				(*job)(i, worker);
+			}
+			catch (...)
+			{
+				error = std::current_exception();
+				_next = count;
+			}
+		}
+
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (error && !_error)
+		{
+			_error = error;
+		}
+
+		_busy--;
+		if (_busy == 0)
+		{
+			_done.notify_all();
+		}
+	}
+}
+
+void ThreadPool::run(size_t count, const PoolJob &job)
+{
+	if (count == 0)
+	{
+		return;
+	}
+
+	/* nested call from one of our own workers, or nobody to help */
+	if (_currentPool == this || _threads.size() == 0)
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			job(i, 0);
+		}
+
+		return;
+	}
+
+	std::lock_guard<std::mutex> running(_runMutex);
+	std::exception_ptr error;
+
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		_job = &job;
+		_count = count;
+		_next = 0;
+		_error = NULL;
+		_busy = _threads.size();
+		_generation++;
+		_wake.notify_all();
+
+		_done.wait(lock, [&] { return _busy == 0; });
+		_job = NULL;
+		error = _error;
+		_error = NULL;
+	}
+
+	if (error)
+	{
+		std::rethrow_exception(error);
+	}
+}
@@ -0,0 +1,78 @@
+// Vagabond
+// Copyright (C) 2019 Helen Ginn
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+// Please email: vagabond @ hginn.co.uk for more details.
+
+#ifndef __vagabond__ThreadPool__
+#define __vagabond__ThreadPool__
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <exception>
+#include <condition_variable>
+
+/* called with the index of the job and the index of the worker which
+ * is running it (0 to threadCount() - 1) */
+typedef std::function<void (size_t, int)> PoolJob;
+
+/** \class ThreadPool
+ *  \brief Keeps a fixed number of worker threads alive and hands out
+ *  indices of a job to them until all indices have been run.
+ *
+ *  Calling run() from within a job of the same pool runs the inner job
+ *  serially on the calling worker rather than deadlocking.
+ **/
+
+class ThreadPool
+{
+public:
+	ThreadPool(int threads = 0);
+	~ThreadPool();
+
+	int threadCount()
+	{
+		return _threads.size();
+	}
+
+	/* number of hardware threads, or 1 if it cannot be determined */
+	static int hardwareThreads();
+
+	/* returns once job(i, worker) has finished for every i in
+	 * [0, count). Exceptions thrown by a job are rethrown here.
+	 * Calls from several outside threads are taken one at a time. */
+	void run(size_t count, const PoolJob &job);
+private:
+	void work(int worker);
+
+	std::vector<std::thread> _threads;
+	std::mutex _runMutex;
+	std::mutex _mutex;
+	std::condition_variable _wake;
+	std::condition_variable _done;
+
+	const PoolJob *_job;
+	size_t _count;
+	std::atomic<size_t> _next;
+	int _busy;
+	unsigned long _generation;
+	bool _quit;
+	std::exception_ptr _error;
+};
+
+#endif
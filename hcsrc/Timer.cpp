@@ -40,7 +40,7 @@ void Timer::start()
 	_tStart = std::chrono::high_resolution_clock::now();
 }
 
-void Timer::quickReport()
+void Timer::quickReport(std::ostream *stream)
 {
 	if (wall > 0)
 	{
@@ -50,14 +50,14 @@ void Timer::quickReport()
 	time_t seconds = (accumulative % 60);
 	time_t minutes = (accumulative - seconds) / 60;
 
-	std::cout << "(";
+	*stream << "(";
 	
 	if (minutes > 0)
 	{
-		std::cout << minutes << "m ";
+		*stream << minutes << "m ";
 	}
 	
-	std::cout << seconds << "s)";
+	*stream << seconds << "s)";
 }
 
 void Timer::stop(bool quick)
@@ -41,7 +41,7 @@ public:
 		_milliseconds = 0;
 	}
 	
-	void quickReport();
+	void quickReport(std::ostream *stream = &std::cout);
 	void report(std::ostream *stream = &std::cout);
 private:
 	time_t wall;
@@ -0,0 +1,217 @@
+/*
+ *      SSE2/AVX implementation of vector operations (64bit double).
+ *
+ * Copyright (c) 2007-2010 Naoaki Okazaki
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/* $Id$ */
+
+/*
+ * Every vector handed to these routines has a length which is a multiple
+ * of 8 (see round_out_variables in lbfgs.c) and is aligned to
+ * LBFGS_VEC_ALIGN bytes. AVX is used when the compiler targets it (-mavx),
+ * otherwise SSE2.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#if     defined(__AVX__)
+#include <immintrin.h>
+
+#define LBFGS_VEC_ALIGN 32
+typedef __m256d vecreg_t;
+#define VEC_WIDTH       4
+#define vr_load(p)      _mm256_load_pd(p)
+#define vr_store(p, a)  _mm256_store_pd((p), (a))
+#define vr_set1(c)      _mm256_set1_pd(c)
+#define vr_zero()       _mm256_setzero_pd()
+#define vr_add(a, b)    _mm256_add_pd((a), (b))
+#define vr_sub(a, b)    _mm256_sub_pd((a), (b))
+#define vr_mul(a, b)    _mm256_mul_pd((a), (b))
+#define vr_xor(a, b)    _mm256_xor_pd((a), (b))
+
+inline static double vr_hsum(vecreg_t a)
+{
+    __m128d lo = _mm256_castpd256_pd128(a);
+    __m128d hi = _mm256_extractf128_pd(a, 1);
+    lo = _mm_add_pd(lo, hi);
+    hi = _mm_unpackhi_pd(lo, lo);
+    return _mm_cvtsd_f64(_mm_add_sd(lo, hi));
+}
+
+#else
+#include <emmintrin.h>
+
+#define LBFGS_VEC_ALIGN 16
+typedef __m128d vecreg_t;
+#define VEC_WIDTH       2
+#define vr_load(p)      _mm_load_pd(p)
+#define vr_store(p, a)  _mm_store_pd((p), (a))
+#define vr_set1(c)      _mm_set1_pd(c)
+#define vr_zero()       _mm_setzero_pd()
+#define vr_add(a, b)    _mm_add_pd((a), (b))
+#define vr_sub(a, b)    _mm_sub_pd((a), (b))
+#define vr_mul(a, b)    _mm_mul_pd((a), (b))
+#define vr_xor(a, b)    _mm_xor_pd((a), (b))
+
+inline static double vr_hsum(vecreg_t a)
+{
+    __m128d hi = _mm_unpackhi_pd(a, a);
+    return _mm_cvtsd_f64(_mm_add_sd(a, hi));
+}
+
+#endif
+
+/* two registers per step keeps 8 doubles in flight with SSE2 (4 x 2) and
+ * AVX (2 x 4) alike */
+#define VEC_STEP        (2 * VEC_WIDTH)
+
+/* compared with zero, as callers keep the result in an int */
+#if     LBFGS_IEEE_FLOAT
+#define fsigndiff(x, y) \
+    ((((*(uint64_t*)(x)) ^ (*(uint64_t*)(y))) & 0x8000000000000000ULL) != 0)
+#else
+#define fsigndiff(x, y) (*(x) * (*(y) / fabs(*(y))) < 0.)
+#endif/*LBFGS_IEEE_FLOAT*/
+
+inline static void* vecalloc(size_t size)
+{
+    void *memblock = _mm_malloc(size, LBFGS_VEC_ALIGN);
+    if (memblock != NULL) {
+        memset(memblock, 0, size);
+    }
+    return memblock;
+}
+
+inline static void vecfree(void *memblock)
+{
+    _mm_free(memblock);
+}
+
+inline static void vecset(lbfgsfloatval_t *x, const lbfgsfloatval_t c, const int n)
+{
+    int i;
+    vecreg_t a = vr_set1(c);
+
+    for (i = 0;i < n;i += VEC_STEP) {
+        vr_store(x + i, a);
+        vr_store(x + i + VEC_WIDTH, a);
+    }
+}
+
+inline static void veccpy(lbfgsfloatval_t *y, const lbfgsfloatval_t *x, const int n)
+{
+    int i;
+
+    for (i = 0;i < n;i += VEC_STEP) {
+        vr_store(y + i, vr_load(x + i));
+        vr_store(y + i + VEC_WIDTH, vr_load(x + i + VEC_WIDTH));
+    }
+}
+
+inline static void vecncpy(lbfgsfloatval_t *y, const lbfgsfloatval_t *x, const int n)
+{
+    int i;
+    vecreg_t sign = vr_set1(-0.);
+
+    for (i = 0;i < n;i += VEC_STEP) {
+        vr_store(y + i, vr_xor(vr_load(x + i), sign));
+        vr_store(y + i + VEC_WIDTH, vr_xor(vr_load(x + i + VEC_WIDTH), sign));
+    }
+}
+
+inline static void vecadd(lbfgsfloatval_t *y, const lbfgsfloatval_t *x, const lbfgsfloatval_t c, const int n)
+{
+    int i;
+    vecreg_t a = vr_set1(c);
+
+    for (i = 0;i < n;i += VEC_STEP) {
+        vecreg_t y0 = vr_add(vr_load(y + i), vr_mul(a, vr_load(x + i)));
+        vecreg_t y1 = vr_add(vr_load(y + i + VEC_WIDTH),
+                             vr_mul(a, vr_load(x + i + VEC_WIDTH)));
+        vr_store(y + i, y0);
+        vr_store(y + i + VEC_WIDTH, y1);
+    }
+}
+
+inline static void vecdiff(lbfgsfloatval_t *z, const lbfgsfloatval_t *x, const lbfgsfloatval_t *y, const int n)
+{
+    int i;
+
+    for (i = 0;i < n;i += VEC_STEP) {
+        vr_store(z + i, vr_sub(vr_load(x + i), vr_load(y + i)));
+        vr_store(z + i + VEC_WIDTH, vr_sub(vr_load(x + i + VEC_WIDTH),
+                                           vr_load(y + i + VEC_WIDTH)));
+    }
+}
+
+inline static void vecscale(lbfgsfloatval_t *y, const lbfgsfloatval_t c, const int n)
+{
+    int i;
+    vecreg_t a = vr_set1(c);
+
+    for (i = 0;i < n;i += VEC_STEP) {
+        vr_store(y + i, vr_mul(vr_load(y + i), a));
+        vr_store(y + i + VEC_WIDTH, vr_mul(vr_load(y + i + VEC_WIDTH), a));
+    }
+}
+
+inline static void vecmul(lbfgsfloatval_t *y, const lbfgsfloatval_t *x, const int n)
+{
+    int i;
+
+    for (i = 0;i < n;i += VEC_STEP) {
+        vr_store(y + i, vr_mul(vr_load(y + i), vr_load(x + i)));
+        vr_store(y + i + VEC_WIDTH, vr_mul(vr_load(y + i + VEC_WIDTH),
+                                           vr_load(x + i + VEC_WIDTH)));
+    }
+}
+
+inline static void vecdot(lbfgsfloatval_t* s, const lbfgsfloatval_t *x, const lbfgsfloatval_t *y, const int n)
+{
+    int i;
+    vecreg_t s0 = vr_zero();
+    vecreg_t s1 = vr_zero();
+
+    for (i = 0;i < n;i += VEC_STEP) {
+        s0 = vr_add(s0, vr_mul(vr_load(x + i), vr_load(y + i)));
+        s1 = vr_add(s1, vr_mul(vr_load(x + i + VEC_WIDTH),
+                               vr_load(y + i + VEC_WIDTH)));
+    }
+
+    *s = vr_hsum(vr_add(s0, s1));
+}
+
+inline static void vec2norm(lbfgsfloatval_t* s, const lbfgsfloatval_t *x, const int n)
+{
+    vecdot(s, x, x, n);
+    *s = (lbfgsfloatval_t)sqrt(*s);
+}
+
+inline static void vec2norminv(lbfgsfloatval_t* s, const lbfgsfloatval_t *x, const int n)
+{
+    vec2norm(s, x, n);
+    *s = (lbfgsfloatval_t)(1.0 / *s);
+}
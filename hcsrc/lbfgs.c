@@ -68,6 +68,7 @@ licence.
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 #include "lbfgs.h"
@@ -99,6 +100,7 @@ struct tag_callback_data {
     void *instance;
     lbfgs_evaluate_t proc_evaluate;
     lbfgs_progress_t proc_progress;
+    lbfgs_batch_evaluate_t proc_batch;
 };
 typedef struct tag_callback_data callback_data_t;
 
@@ -110,11 +112,21 @@ struct tag_iteration_data {
 };
 typedef struct tag_iteration_data iteration_data_t;
 
+struct tag_lbfgs_history {
+    int n;                  /* number of variables the pairs are for */
+    int m;                  /* number of slots in lm */
+    int count;              /* pairs held, at most m */
+    int end;                /* slot after the newest pair */
+    lbfgsfloatval_t yy;     /* vecdot(y, y) of the newest pair */
+    iteration_data_t *lm;   /* [m], NULL when empty */
+};
+
 static const lbfgs_parameter_t _defparam = {
     6, 1e-5, 0, 1e-5,
     0, LBFGS_LINESEARCH_DEFAULT, 40,
     1e-20, 1e20, 1e-4, 0.9, 0.9, 1.0e-16,
-    0.0, 0, -1,
+    0.0, 0, -1, NULL,
+    NULL, 4, NULL,
 };
 
 /* Forward function declarations. */
@@ -175,6 +187,20 @@ static int line_search_morethuente(
     const lbfgs_parameter_t *param
     );
 
+static int line_search_parallel(
+    int n,
+    lbfgsfloatval_t *x,
+    lbfgsfloatval_t *f,
+    lbfgsfloatval_t *g,
+    lbfgsfloatval_t *s,
+    lbfgsfloatval_t *stp,
+    const lbfgsfloatval_t* xp,
+    const lbfgsfloatval_t* gp,
+    lbfgsfloatval_t *wa,
+    callback_data_t *cd,
+    const lbfgs_parameter_t *param
+    );
+
 static int update_trial_interval(
     lbfgsfloatval_t *x,
     lbfgsfloatval_t *fx,
@@ -214,6 +240,82 @@ static void owlqn_project(
     );
 
 
+/*
+ * Vector operations of the main loop and line searches, going through
+ * lbfgs_parameter_t::vector_ops where the caller has provided them.
+ */
+inline static void opsdot(const lbfgs_parameter_t *param, lbfgsfloatval_t* s, const lbfgsfloatval_t *x, const lbfgsfloatval_t *y, const int n)
+{
+    const lbfgs_vector_ops_t *ops = param->vector_ops;
+    if (ops != NULL && ops->dot != NULL) {
+        ops->dot(ops->instance, s, x, y, n);
+    } else {
+        vecdot(s, x, y, n);
+    }
+}
+
+inline static void ops2norm(const lbfgs_parameter_t *param, lbfgsfloatval_t* s, const lbfgsfloatval_t *x, const int n)
+{
+    opsdot(param, s, x, x, n);
+    *s = (lbfgsfloatval_t)sqrt(*s);
+}
+
+inline static void ops2norminv(const lbfgs_parameter_t *param, lbfgsfloatval_t* s, const lbfgsfloatval_t *x, const int n)
+{
+    ops2norm(param, s, x, n);
+    *s = (lbfgsfloatval_t)(1.0 / *s);
+}
+
+inline static void opscpy(const lbfgs_parameter_t *param, lbfgsfloatval_t *y, const lbfgsfloatval_t *x, const int n)
+{
+    const lbfgs_vector_ops_t *ops = param->vector_ops;
+    if (ops != NULL && ops->cpy != NULL) {
+        ops->cpy(ops->instance, y, x, n);
+    } else {
+        veccpy(y, x, n);
+    }
+}
+
+inline static void opsncpy(const lbfgs_parameter_t *param, lbfgsfloatval_t *y, const lbfgsfloatval_t *x, const int n)
+{
+    const lbfgs_vector_ops_t *ops = param->vector_ops;
+    if (ops != NULL && ops->ncpy != NULL) {
+        ops->ncpy(ops->instance, y, x, n);
+    } else {
+        vecncpy(y, x, n);
+    }
+}
+
+inline static void opsadd(const lbfgs_parameter_t *param, lbfgsfloatval_t *y, const lbfgsfloatval_t *x, const lbfgsfloatval_t c, const int n)
+{
+    const lbfgs_vector_ops_t *ops = param->vector_ops;
+    if (ops != NULL && ops->add != NULL) {
+        ops->add(ops->instance, y, x, c, n);
+    } else {
+        vecadd(y, x, c, n);
+    }
+}
+
+inline static void opsdiff(const lbfgs_parameter_t *param, lbfgsfloatval_t *z, const lbfgsfloatval_t *x, const lbfgsfloatval_t *y, const int n)
+{
+    const lbfgs_vector_ops_t *ops = param->vector_ops;
+    if (ops != NULL && ops->diff != NULL) {
+        ops->diff(ops->instance, z, x, y, n);
+    } else {
+        vecdiff(z, x, y, n);
+    }
+}
+
+inline static void opsscale(const lbfgs_parameter_t *param, lbfgsfloatval_t *y, const lbfgsfloatval_t c, const int n)
+{
+    const lbfgs_vector_ops_t *ops = param->vector_ops;
+    if (ops != NULL && ops->scale != NULL) {
+        ops->scale(ops->instance, y, c, n);
+    } else {
+        vecscale(y, c, n);
+    }
+}
+
 #if     defined(USE_SSE) && (defined(__SSE__) || defined(__SSE2__))
 static int round_out_variables(int n)
 {
@@ -224,6 +326,204 @@ static int round_out_variables(int n)
 }
 #endif/*defined(USE_SSE)*/
 
+int lbfgs_padded_length(int n)
+{
+#if     defined(USE_SSE) && (defined(__SSE__) || defined(__SSE2__))
+    n = round_out_variables(n);
+#endif/*defined(USE_SSE)*/
+    return n;
+}
+
+/*
+ * Turns d = -g into the quasi-Newton direction using the newest bound of
+ * the correction pairs in lm, the slot after the newest being end.
+ */
+static void two_loop(
+    lbfgsfloatval_t *d,
+    iteration_data_t *lm,
+    const int m,
+    const int end,
+    const int bound,
+    const lbfgsfloatval_t ys,
+    const lbfgsfloatval_t yy,
+    const int n,
+    const lbfgs_parameter_t *param
+    )
+{
+    int i, j;
+    lbfgsfloatval_t beta;
+    iteration_data_t *it = NULL;
+
+    j = end;
+    for (i = 0;i < bound;++i) {
+        j = (j + m - 1) % m;    /* if (--j == -1) j = m-1; */
+        it = &lm[j];
+        /* \alpha_{j} = \rho_{j} s^{t}_{j} \cdot q_{k+1}. */
+        opsdot(param, &it->alpha, it->s, d, n);
+        it->alpha /= it->ys;
+        /* q_{i} = q_{i+1} - \alpha_{i} y_{i}. */
+        opsadd(param, d, it->y, -it->alpha, n);
+    }
+
+    opsscale(param, d, ys / yy, n);
+
+    for (i = 0;i < bound;++i) {
+        it = &lm[j];
+        /* \beta_{j} = \rho_{j} y^t_{j} \cdot \gamma_{i}. */
+        opsdot(param, &beta, it->y, d, n);
+        beta /= it->ys;
+        /* \gamma_{i+1} = \gamma_{i} + (\alpha_{j} - \beta_{j}) s_{j}. */
+        opsadd(param, d, it->s, it->alpha - beta, n);
+        j = (j + 1) % m;        /* if (++j == m) j = 0; */
+    }
+}
+
+static void free_iteration_data(iteration_data_t *lm, int m)
+{
+    int i;
+
+    if (lm != NULL) {
+        for (i = 0;i < m;++i) {
+            vecfree(lm[i].s);
+            vecfree(lm[i].y);
+        }
+        vecfree(lm);
+    }
+}
+
+lbfgs_history_t *lbfgs_history_new(void)
+{
+    lbfgs_history_t *history = (lbfgs_history_t*)malloc(sizeof(lbfgs_history_t));
+    if (history != NULL) {
+        history->lm = NULL;
+        lbfgs_history_clear(history);
+    }
+    return history;
+}
+
+void lbfgs_history_clear(lbfgs_history_t *history)
+{
+    free_iteration_data(history->lm, history->m);
+    history->lm = NULL;
+    history->n = 0;
+    history->m = 0;
+    history->count = 0;
+    history->end = 0;
+    history->yy = 0.;
+}
+
+int lbfgs_history_count(const lbfgs_history_t *history)
+{
+    return history->count;
+}
+
+size_t lbfgs_history_bytes(const lbfgs_history_t *history)
+{
+    size_t pair = sizeof(lbfgsfloatval_t) * (1 + 2 * (size_t)history->n);
+    return 3 * sizeof(int) + sizeof(lbfgsfloatval_t) + history->count * pair;
+}
+
+void lbfgs_history_save(const lbfgs_history_t *history, void *buffer)
+{
+    int i, j;
+    const int m = history->m;
+    const size_t length = history->n * sizeof(lbfgsfloatval_t);
+    char *p = (char*)buffer;
+
+    memcpy(p, &history->n, sizeof(int)); p += sizeof(int);
+    memcpy(p, &history->m, sizeof(int)); p += sizeof(int);
+    memcpy(p, &history->count, sizeof(int)); p += sizeof(int);
+    memcpy(p, &history->yy, sizeof(lbfgsfloatval_t));
+    p += sizeof(lbfgsfloatval_t);
+
+    /* Oldest pair first. */
+    j = (history->end + m - history->count) % (m > 0 ? m : 1);
+    for (i = 0;i < history->count;++i) {
+        const iteration_data_t *it = &history->lm[j];
+        memcpy(p, &it->ys, sizeof(lbfgsfloatval_t));
+        p += sizeof(lbfgsfloatval_t);
+        memcpy(p, it->s, length); p += length;
+        memcpy(p, it->y, length); p += length;
+        j = (j + 1) % m;
+    }
+}
+
+int lbfgs_history_load(lbfgs_history_t *history, const void *buffer, size_t bytes)
+{
+    int i, n, m, count;
+    size_t length;
+    const char *p = (const char*)buffer;
+    iteration_data_t *lm = NULL;
+
+    if (bytes < 3 * sizeof(int) + sizeof(lbfgsfloatval_t)) {
+        return LBFGSERR_INVALIDPARAMETERS;
+    }
+
+    memcpy(&n, p, sizeof(int)); p += sizeof(int);
+    memcpy(&m, p, sizeof(int)); p += sizeof(int);
+    memcpy(&count, p, sizeof(int)); p += sizeof(int);
+
+    lbfgs_history_clear(history);
+    if (n == 0 && m == 0 && count == 0) {
+        /* Saved while empty. */
+        return 0;
+    }
+    if (n <= 0 || m <= 0 || count < 0 || m < count) {
+        return LBFGSERR_INVALIDPARAMETERS;
+    }
+
+    length = n * sizeof(lbfgsfloatval_t);
+    if (bytes != 3 * sizeof(int) + sizeof(lbfgsfloatval_t) +
+        count * (sizeof(lbfgsfloatval_t) + 2 * length)) {
+        return LBFGSERR_INVALIDPARAMETERS;
+    }
+
+    memcpy(&history->yy, p, sizeof(lbfgsfloatval_t));
+    p += sizeof(lbfgsfloatval_t);
+
+    lm = (iteration_data_t*)vecalloc(m * sizeof(iteration_data_t));
+    if (lm == NULL) {
+        return LBFGSERR_OUTOFMEMORY;
+    }
+
+    for (i = 0;i < m;++i) {
+        lm[i].s = (lbfgsfloatval_t*)vecalloc(length);
+        lm[i].y = (lbfgsfloatval_t*)vecalloc(length);
+        if (lm[i].s == NULL || lm[i].y == NULL) {
+            free_iteration_data(lm, m);
+            return LBFGSERR_OUTOFMEMORY;
+        }
+    }
+
+    for (i = 0;i < count;++i) {
+        memcpy(&lm[i].ys, p, sizeof(lbfgsfloatval_t));
+        p += sizeof(lbfgsfloatval_t);
+        memcpy(lm[i].s, p, length); p += length;
+        memcpy(lm[i].y, p, length); p += length;
+    }
+
+    history->lm = lm;
+    history->n = n;
+    history->m = m;
+    history->count = count;
+    history->end = count % m;
+    return 0;
+}
+
+void lbfgs_history_free(lbfgs_history_t *history)
+{
+    if (history != NULL) {
+        lbfgs_history_clear(history);
+        free(history);
+    }
+}
+
+size_t lbfgs_history_pair_size(int n)
+{
+    size_t length = (size_t)lbfgs_padded_length(n);
+    return sizeof(iteration_data_t) + 2 * length * sizeof(lbfgsfloatval_t);
+}
+
 lbfgsfloatval_t* lbfgs_malloc(int n)
 {
 #if     defined(USE_SSE) && (defined(__SSE__) || defined(__SSE2__))
@@ -253,7 +553,7 @@ int lbfgs(
     )
 {
     int ret;
-    int i, j, k, ls, end, bound;
+    int i, k, ls, end = 0, bound, pairs = 0;
     lbfgsfloatval_t step;
 
     /* Constant parameters and their default values. */
@@ -264,8 +564,9 @@ int lbfgs(
     lbfgsfloatval_t *g = NULL, *gp = NULL, *pg = NULL;
     lbfgsfloatval_t *d = NULL, *w = NULL, *pf = NULL;
     iteration_data_t *lm = NULL, *it = NULL;
-    lbfgsfloatval_t ys, yy;
-    lbfgsfloatval_t xnorm, gnorm, beta;
+    lbfgsfloatval_t ys = 0., yy = 0.;
+    lbfgsfloatval_t xnorm, gnorm;
+    lbfgs_history_t *history = NULL;
     lbfgsfloatval_t fx = 0.;
     lbfgsfloatval_t rate = 0.;
     line_search_proc linesearch = line_search_morethuente;
@@ -276,6 +577,7 @@ int lbfgs(
     cd.instance = instance;
     cd.proc_evaluate = proc_evaluate;
     cd.proc_progress = proc_progress;
+    cd.proc_batch = param.batch_evaluate;
 
 #if     defined(USE_SSE) && (defined(__SSE__) || defined(__SSE2__))
     /* Round out the number of variables. */
@@ -290,7 +592,7 @@ int lbfgs(
     if (n % 8 != 0) {
         return LBFGSERR_INVALID_N_SSE;
     }
-    if ((uintptr_t)(const void*)x % 16 != 0) {
+    if ((uintptr_t)(const void*)x % LBFGS_VEC_ALIGN != 0) {
         return LBFGSERR_INVALID_X_SSE;
     }
 #endif/*defined(USE_SSE)*/
@@ -313,7 +615,9 @@ int lbfgs(
         return LBFGSERR_INVALID_FTOL;
     }
     if (param.linesearch == LBFGS_LINESEARCH_BACKTRACKING_WOLFE ||
-        param.linesearch == LBFGS_LINESEARCH_BACKTRACKING_STRONG_WOLFE) {
+        param.linesearch == LBFGS_LINESEARCH_BACKTRACKING_STRONG_WOLFE ||
+        (param.batch_evaluate != NULL &&
+         param.linesearch == LBFGS_LINESEARCH_MORETHUENTE)) {
         if (param.wolfe <= param.ftol || 1. <= param.wolfe) {
             return LBFGSERR_INVALID_WOLFE;
         }
@@ -327,6 +631,9 @@ int lbfgs(
     if (param.max_linesearch <= 0) {
         return LBFGSERR_INVALID_MAXLINESEARCH;
     }
+    if (param.batch_evaluate != NULL && param.batch_steps <= 0) {
+        return LBFGSERR_INVALIDPARAMETERS;
+    }
     if (param.orthantwise_c < 0.) {
         return LBFGSERR_INVALID_ORTHANTWISE;
     }
@@ -361,6 +668,10 @@ int lbfgs(
         default:
             return LBFGSERR_INVALID_LINESEARCH;
         }
+
+        if (param.batch_evaluate != NULL) {
+            linesearch = line_search_parallel;
+        }
     }
 
     /* Allocate working space. */
@@ -383,24 +694,48 @@ int lbfgs(
         }
     }
 
-    /* Allocate limited memory storage. */
-    lm = (iteration_data_t*)vecalloc(m * sizeof(iteration_data_t));
-    if (lm == NULL) {
-        ret = LBFGSERR_OUTOFMEMORY;
-        goto lbfgs_exit;
+    if (param.orthantwise_c == 0.) {
+        history = param.history;
     }
 
-    /* Initialize the limited memory. */
-    for (i = 0;i < m;++i) {
-        it = &lm[i];
-        it->alpha = 0;
-        it->ys = 0;
-        it->s = (lbfgsfloatval_t*)vecalloc(n * sizeof(lbfgsfloatval_t));
-        it->y = (lbfgsfloatval_t*)vecalloc(n * sizeof(lbfgsfloatval_t));
-        if (it->s == NULL || it->y == NULL) {
+    if (history != NULL && history->lm != NULL &&
+        history->n == n && history->m == m) {
+        /* Carry on with the limited memory of the previous call. */
+        lm = history->lm;
+        pairs = history->count;
+        end = history->end;
+        yy = history->yy;
+        ys = lm[(end + m - 1) % m].ys;
+    } else {
+        if (history != NULL) {
+            lbfgs_history_clear(history);
+        }
+
+        /* Allocate limited memory storage. */
+        lm = (iteration_data_t*)vecalloc(m * sizeof(iteration_data_t));
+        if (lm == NULL) {
             ret = LBFGSERR_OUTOFMEMORY;
             goto lbfgs_exit;
         }
+
+        /* Initialize the limited memory. */
+        for (i = 0;i < m;++i) {
+            it = &lm[i];
+            it->alpha = 0;
+            it->ys = 0;
+            it->s = (lbfgsfloatval_t*)vecalloc(n * sizeof(lbfgsfloatval_t));
+            it->y = (lbfgsfloatval_t*)vecalloc(n * sizeof(lbfgsfloatval_t));
+            if (it->s == NULL || it->y == NULL) {
+                ret = LBFGSERR_OUTOFMEMORY;
+                goto lbfgs_exit;
+            }
+        }
+
+        if (history != NULL) {
+            history->lm = lm;
+            history->n = n;
+            history->m = m;
+        }
     }
 
     /* Allocate an array for storing previous values of the objective function. */
@@ -430,19 +765,19 @@ int lbfgs(
         we assume the initial hessian matrix H_0 as the identity matrix.
      */
     if (param.orthantwise_c == 0.) {
-        vecncpy(d, g, n);
+        opsncpy(&param, d, g, n);
     } else {
-        vecncpy(d, pg, n);
+        opsncpy(&param, d, pg, n);
     }
 
     /*
        Make sure that the initial variables are not a minimizer.
      */
-    vec2norm(&xnorm, x, n);
+    ops2norm(&param, &xnorm, x, n);
     if (param.orthantwise_c == 0.) {
-        vec2norm(&gnorm, g, n);
+        ops2norm(&param, &gnorm, g, n);
     } else {
-        vec2norm(&gnorm, pg, n);
+        ops2norm(&param, &gnorm, pg, n);
     }
     if (xnorm < 1.0) xnorm = 1.0;
     if (gnorm / xnorm <= param.epsilon) {
@@ -453,14 +788,20 @@ int lbfgs(
     /* Compute the initial step:
         step = 1.0 / sqrt(vecdot(d, d, n))
      */
-    vec2norminv(&step, d, n);
+    ops2norminv(&param, &step, d, n);
+
+    if (0 < pairs) {
+        /* Start along the direction given by the kept pairs. */
+        bound = (m <= pairs) ? m : pairs;
+        two_loop(d, lm, m, end, bound, ys, yy, n, &param);
+        step = 1.0;
+    }
 
     k = 1;
-    end = 0;
     for (;;) {
         /* Store the current position and gradient vectors. */
-        veccpy(xp, x, n);
-        veccpy(gp, g, n);
+        opscpy(&param, xp, x, n);
+        opscpy(&param, gp, g, n);
 
         /* Search for an optimal step. */
         if (param.orthantwise_c == 0.) {
@@ -474,18 +815,18 @@ int lbfgs(
         }
         if (ls < 0) {
             /* Revert to the previous point. */
-            veccpy(x, xp, n);
-            veccpy(g, gp, n);
+            opscpy(&param, x, xp, n);
+            opscpy(&param, g, gp, n);
             ret = ls;
             goto lbfgs_exit;
         }
 
         /* Compute x and g norms. */
-        vec2norm(&xnorm, x, n);
+        ops2norm(&param, &xnorm, x, n);
         if (param.orthantwise_c == 0.) {
-            vec2norm(&gnorm, g, n);
+            ops2norm(&param, &gnorm, g, n);
         } else {
-            vec2norm(&gnorm, pg, n);
+            ops2norm(&param, &gnorm, pg, n);
         }
 
         /* Report the progress. */
@@ -541,8 +882,8 @@ int lbfgs(
                 y_{k+1} = g_{k+1} - g_{k}.
          */
         it = &lm[end];
-        vecdiff(it->s, x, xp, n);
-        vecdiff(it->y, g, gp, n);
+        opsdiff(&param, it->s, x, xp, n);
+        opsdiff(&param, it->y, g, gp, n);
 
         /*
             Compute scalars ys and yy:
@@ -550,8 +891,8 @@ int lbfgs(
                 yy = y^t \cdot y.
             Notice that yy is used for scaling the hessian matrix H_0 (Cholesky factor).
          */
-        vecdot(&ys, it->y, it->s, n);
-        vecdot(&yy, it->y, it->y, n);
+        opsdot(&param, &ys, it->y, it->s, n);
+        opsdot(&param, &yy, it->y, it->y, n);
         it->ys = ys;
 
         /*
@@ -562,40 +903,27 @@ int lbfgs(
                 Mathematics of Computation, Vol. 35, No. 151,
                 pp. 773--782, 1980.
          */
-        bound = (m <= k) ? m : k;
+        ++pairs;
+        bound = (m <= pairs) ? m : pairs;
         ++k;
         end = (end + 1) % m;
 
+        /* Keep the history up to date for anyone saving it. */
+        if (history != NULL) {
+            history->count = bound;
+            history->end = end;
+            history->yy = yy;
+        }
+
         /* Compute the steepest direction. */
         if (param.orthantwise_c == 0.) {
             /* Compute the negative of gradients. */
-            vecncpy(d, g, n);
+            opsncpy(&param, d, g, n);
         } else {
-            vecncpy(d, pg, n);
-        }
-
-        j = end;
-        for (i = 0;i < bound;++i) {
-            j = (j + m - 1) % m;    /* if (--j == -1) j = m-1; */
-            it = &lm[j];
-            /* \alpha_{j} = \rho_{j} s^{t}_{j} \cdot q_{k+1}. */
-            vecdot(&it->alpha, it->s, d, n);
-            it->alpha /= it->ys;
-            /* q_{i} = q_{i+1} - \alpha_{i} y_{i}. */
-            vecadd(d, it->y, -it->alpha, n);
+            opsncpy(&param, d, pg, n);
         }
 
-        vecscale(d, ys / yy, n);
-
-        for (i = 0;i < bound;++i) {
-            it = &lm[j];
-            /* \beta_{j} = \rho_{j} y^t_{j} \cdot \gamma_{i}. */
-            vecdot(&beta, it->y, d, n);
-            beta /= it->ys;
-            /* \gamma_{i+1} = \gamma_{i} + (\alpha_{j} - \beta_{j}) s_{j}. */
-            vecadd(d, it->s, it->alpha - beta, n);
-            j = (j + 1) % m;        /* if (++j == m) j = 0; */
-        }
+        two_loop(d, lm, m, end, bound, ys, yy, n, &param);
 
         /*
             Constrain the search direction for orthant-wise updates.
@@ -622,14 +950,13 @@ lbfgs_exit:
 
     vecfree(pf);
 
-    /* Free memory blocks used by this function. */
-    if (lm != NULL) {
-        for (i = 0;i < m;++i) {
-            vecfree(lm[i].s);
-            vecfree(lm[i].y);
-        }
-        vecfree(lm);
+    /* The limited memory stays with the history for the next call. */
+    if (history != NULL && history->lm == lm) {
+        lm = NULL;
     }
+
+    /* Free memory blocks used by this function. */
+    free_iteration_data(lm, m);
     vecfree(pg);
     vecfree(w);
     vecfree(d);
@@ -667,7 +994,7 @@ static int line_search_backtracking(
     }
 
     /* Compute the initial gradient in the search direction. */
-    vecdot(&dginit, g, s, n);
+    opsdot(param, &dginit, g, s, n);
 
     /* Make sure that s points to a descent direction. */
     if (0 < dginit) {
@@ -679,8 +1006,8 @@ static int line_search_backtracking(
     dgtest = param->ftol * dginit;
 
     for (;;) {
-        veccpy(x, xp, n);
-        vecadd(x, s, *stp, n);
+        opscpy(param, x, xp, n);
+        opsadd(param, x, s, *stp, n);
 
         /* Evaluate the function and gradient values. */
         *f = cd->proc_evaluate(cd->instance, x, g, cd->n, *stp);
@@ -697,7 +1024,7 @@ static int line_search_backtracking(
 	        }
 
 	        /* Check the Wolfe condition. */
-	        vecdot(&dg, g, s, n);
+	        opsdot(param, &dg, g, s, n);
 	        if (dg < param->wolfe * dginit) {
     		    width = inc;
 	        } else {
@@ -733,6 +1060,131 @@ static int line_search_backtracking(
     }
 }
 
+static int line_search_parallel(
+    int n,
+    lbfgsfloatval_t *x,
+    lbfgsfloatval_t *f,
+    lbfgsfloatval_t *g,
+    lbfgsfloatval_t *s,
+    lbfgsfloatval_t *stp,
+    const lbfgsfloatval_t* xp,
+    const lbfgsfloatval_t* gp,
+    lbfgsfloatval_t *wp,
+    callback_data_t *cd,
+    const lbfgs_parameter_t *param
+    )
+{
+    int i, k, count = 0;
+    const int batch = param->batch_steps;
+    lbfgsfloatval_t width, dg;
+    lbfgsfloatval_t finit, dginit = 0., dgtest;
+    lbfgsfloatval_t *steps = NULL, *fs = NULL;
+    const lbfgsfloatval_t dec = 0.5, inc = 2.1;
+    int ret = LBFGSERR_LOGICERROR;
+
+    /* Check the input parameters for errors. */
+    if (*stp <= 0.) {
+        return LBFGSERR_INVALIDPARAMETERS;
+    }
+
+    /* Compute the initial gradient in the search direction. */
+    opsdot(param, &dginit, g, s, n);
+
+    /* Make sure that s points to a descent direction. */
+    if (0 < dginit) {
+        return LBFGSERR_INCREASEGRADIENT;
+    }
+
+    steps = (lbfgsfloatval_t*)malloc(2 * batch * sizeof(lbfgsfloatval_t));
+    if (steps == NULL) {
+        return LBFGSERR_OUTOFMEMORY;
+    }
+    fs = steps + batch;
+
+    /* The initial value of the objective function. */
+    finit = *f;
+    dgtest = param->ftol * dginit;
+
+    for (;;) {
+        /* The step lengths the serial backtracking would try next. */
+        for (i = 0;i < batch;++i) {
+            steps[i] = (i == 0) ? *stp : steps[i-1] * dec;
+        }
+
+        /* Evaluate the function values only, all at once. */
+        cd->proc_batch(cd->instance, xp, s, steps, fs, cd->n, batch);
+        count += batch;
+
+        /* The longest step meeting the sufficient decrease condition. */
+        for (k = 0;k < batch;++k) {
+            if (fs[k] <= finit + steps[k] * dgtest) {
+                break;
+            }
+        }
+
+        if (k == batch) {
+            *stp = steps[batch-1];
+            width = dec;
+        } else {
+            *stp = steps[k];
+            opscpy(param, x, xp, n);
+            opsadd(param, x, s, *stp, n);
+
+            /* Evaluate the function and gradient values at this step. */
+            *f = cd->proc_evaluate(cd->instance, x, g, cd->n, *stp);
+            ++count;
+
+            if (param->linesearch == LBFGS_LINESEARCH_BACKTRACKING_ARMIJO) {
+                /* Exit with the Armijo condition. */
+                ret = count;
+                break;
+            }
+
+            /* Check the Wolfe condition. */
+            opsdot(param, &dg, g, s, n);
+            if (dg < param->wolfe * dginit) {
+                width = inc;
+            } else {
+                if (param->linesearch == LBFGS_LINESEARCH_BACKTRACKING_WOLFE) {
+                    /* Exit with the regular Wolfe condition. */
+                    ret = count;
+                    break;
+                }
+
+                /* Check the strong Wolfe condition. */
+                if (dg > -param->wolfe * dginit) {
+                    width = dec;
+                } else {
+                    /* Exit with the strong Wolfe condition. */
+                    ret = count;
+                    break;
+                }
+            }
+        }
+
+        if (*stp < param->min_step) {
+            /* The step is the minimum value. */
+            ret = LBFGSERR_MINIMUMSTEP;
+            break;
+        }
+        if (*stp > param->max_step) {
+            /* The step is the maximum value. */
+            ret = LBFGSERR_MAXIMUMSTEP;
+            break;
+        }
+        if (param->max_linesearch <= count) {
+            /* Maximum number of iteration. */
+            ret = LBFGSERR_MAXIMUMLINESEARCH;
+            break;
+        }
+
+        (*stp) *= width;
+    }
+
+    free(steps);
+    return ret;
+}
+
 
 
 static int line_search_backtracking_owlqn(
@@ -765,8 +1217,8 @@ static int line_search_backtracking_owlqn(
 
     for (;;) {
         /* Update the current point. */
-        veccpy(x, xp, n);
-        vecadd(x, s, *stp, n);
+        opscpy(param, x, xp, n);
+        opsadd(param, x, s, *stp, n);
 
         /* The current point is projected onto the orthant. */
         owlqn_project(x, wp, param->orthantwise_start, param->orthantwise_end);
@@ -839,7 +1291,7 @@ static int line_search_morethuente(
     }
 
     /* Compute the initial gradient in the search direction. */
-    vecdot(&dginit, g, s, n);
+    opsdot(param, &dginit, g, s, n);
 
     /* Make sure that s points to a descent direction. */
     if (0 < dginit) {
@@ -896,12 +1348,12 @@ static int line_search_morethuente(
             Compute the current value of x:
                 x <- x + (*stp) * s.
          */
-        veccpy(x, xp, n);
-        vecadd(x, s, *stp, n);
+        opscpy(param, x, xp, n);
+        opsadd(param, x, s, *stp, n);
 
         /* Evaluate the function and gradient values. */
         *f = cd->proc_evaluate(cd->instance, x, g, cd->n, *stp);
-        vecdot(&dg, g, s, n);
+        opsdot(param, &dg, g, s, n);
 
         ftest1 = finit + *stp * dgtest;
         ++count;
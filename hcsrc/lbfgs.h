@@ -29,6 +29,8 @@
 #ifndef __LBFGS_H__
 #define __LBFGS_H__
 
+#include <stddef.h>
+
 #ifdef  __cplusplus
 extern "C" {
 #endif/*__cplusplus*/
@@ -91,7 +93,7 @@ enum {
     LBFGSERR_INVALID_N,
     /** Invalid number of variables (for SSE) specified. */
     LBFGSERR_INVALID_N_SSE,
-    /** The array x must be aligned to 16 (for SSE). */
+    /** The array x must be aligned to 16 (for SSE) or 32 (for AVX). */
     LBFGSERR_INVALID_X_SSE,
     /** Invalid parameter lbfgs_parameter_t::epsilon specified. */
     LBFGSERR_INVALID_EPSILON,
@@ -190,6 +192,68 @@ enum {
     LBFGS_LINESEARCH_BACKTRACKING_STRONG_WOLFE = 3,
 };
 
+/**
+ * Replacement vector operations.
+ *  Each routine works on arrays of n variables and receives the instance
+ *  pointer given here. Any routine left NULL falls back on the built-in
+ *  one. Used by the L-BFGS loop and line searches (not by OWL-QN).
+ */
+typedef struct {
+    /** Passed on to every routine. */
+    void *instance;
+    /** *s = x^T y. */
+    void (*dot)(void *instance, lbfgsfloatval_t *s,
+                const lbfgsfloatval_t *x, const lbfgsfloatval_t *y,
+                const int n);
+    /** y = x. */
+    void (*cpy)(void *instance, lbfgsfloatval_t *y,
+                const lbfgsfloatval_t *x, const int n);
+    /** y = -x. */
+    void (*ncpy)(void *instance, lbfgsfloatval_t *y,
+                 const lbfgsfloatval_t *x, const int n);
+    /** y += c * x. */
+    void (*add)(void *instance, lbfgsfloatval_t *y,
+                const lbfgsfloatval_t *x, const lbfgsfloatval_t c,
+                const int n);
+    /** z = x - y. */
+    void (*diff)(void *instance, lbfgsfloatval_t *z,
+                 const lbfgsfloatval_t *x, const lbfgsfloatval_t *y,
+                 const int n);
+    /** y *= c. */
+    void (*scale)(void *instance, lbfgsfloatval_t *y,
+                  const lbfgsfloatval_t c, const int n);
+} lbfgs_vector_ops_t;
+
+/**
+ * Callback interface to evaluate several step lengths at once.
+ *
+ *  Only the objective function is needed, not its gradients, and the
+ *  points may be evaluated concurrently by the client program.
+ *
+ *  @param  instance    The user data sent for lbfgs() function by the client.
+ *  @param  xp          The variables at the start of the line search.
+ *  @param  s           The search direction.
+ *  @param  steps       The step lengths to try.
+ *  @param  fs          Receives the objective function at xp + steps[k] * s.
+ *  @param  n           The number of variables.
+ *  @param  count       The number of step lengths.
+ */
+typedef void (*lbfgs_batch_evaluate_t)(
+    void *instance,
+    const lbfgsfloatval_t *xp,
+    const lbfgsfloatval_t *s,
+    const lbfgsfloatval_t *steps,
+    lbfgsfloatval_t *fs,
+    const int n,
+    const int count
+    );
+
+/**
+ * Correction pairs kept from one call of lbfgs() to the next.
+ *  See lbfgs_parameter_t::history.
+ */
+typedef struct tag_lbfgs_history lbfgs_history_t;
+
 /**
  * L-BFGS optimization parameters.
  *  Call lbfgs_parameter_init() function to initialize parameters to the
@@ -355,6 +419,41 @@ typedef struct {
      *  L1 norm of the variables x,
      */
     int             orthantwise_end;
+
+    /**
+     * Vector operations to use instead of the built-in ones.
+     *  The default value is NULL, keeping the built-in routines.
+     */
+    const lbfgs_vector_ops_t *vector_ops;
+
+    /**
+     * Batch evaluation for the parallel line search.
+     *  When set (and orthantwise_c is zero) the line search scores
+     *  batch_steps decreasing step lengths in one call and takes the
+     *  longest which meets the sufficient decrease condition; only that
+     *  step is evaluated again with gradients, to check the Wolfe
+     *  conditions if ::linesearch asks for them. The More-Thuente
+     *  setting is treated as the strong Wolfe condition. The default
+     *  value is NULL, keeping the serial line searches.
+     */
+    lbfgs_batch_evaluate_t batch_evaluate;
+
+    /**
+     * The number of step lengths given to batch_evaluate at a time.
+     *  The default value is \c 4.
+     */
+    int             batch_steps;
+
+    /**
+     * Storage for correction pairs between calls to lbfgs().
+     *  When set, lbfgs() starts from the pairs left here by the previous
+     *  call, as long as that call had the same number of variables and
+     *  the same ::m, and takes its first step along the quasi-Newton
+     *  direction rather than steepest descent. Its own pairs are left
+     *  here on return. Not used by the OWL-QN method. The default value
+     *  is NULL, starting afresh every time.
+     */
+    lbfgs_history_t *history;
 } lbfgs_parameter_t;
 
 
@@ -507,6 +606,83 @@ void lbfgs_parameter_init(lbfgs_parameter_t *param);
  */
 lbfgsfloatval_t* lbfgs_malloc(int n);
 
+/**
+ * Length of the array ::lbfgs_malloc would allocate for n variables.
+ *
+ *  With SSE/SSE2/AVX routines enabled this is n rounded up to a multiple
+ *  of 8; the extra elements must be zero. Otherwise it is n.
+ *
+ *  @param  n           The number of variables.
+ */
+int lbfgs_padded_length(int n);
+
+/**
+ * Bytes lbfgs() allocates for each of the lbfgs_parameter_t::m
+ * correction pairs when minimising n variables.
+ *
+ *  @param  n           The number of variables.
+ */
+size_t lbfgs_history_pair_size(int n);
+
+/**
+ * Allocate empty storage for correction pairs.
+ *
+ *  @retval lbfgs_history_t*    The storage, or NULL if out of memory.
+ */
+lbfgs_history_t *lbfgs_history_new(void);
+
+/**
+ * Forget any correction pairs held, so that the next lbfgs() call using
+ * this storage starts afresh.
+ *
+ *  @param  history     Storage from ::lbfgs_history_new.
+ */
+void lbfgs_history_clear(lbfgs_history_t *history);
+
+/**
+ * Number of correction pairs held.
+ *
+ *  @param  history     Storage from ::lbfgs_history_new.
+ */
+int lbfgs_history_count(const lbfgs_history_t *history);
+
+/**
+ * Bytes needed by ::lbfgs_history_save for the pairs held now.
+ *
+ *  @param  history     Storage from ::lbfgs_history_new.
+ */
+size_t lbfgs_history_bytes(const lbfgs_history_t *history);
+
+/**
+ * Copy the pairs held into a flat buffer, e.g. for writing to disk.
+ *  The history may be saved from within the progress callback of an
+ *  lbfgs() call using it; it then holds the pairs of all but the
+ *  latest iteration.
+ *
+ *  @param  history     Storage from ::lbfgs_history_new.
+ *  @param  buffer      At least ::lbfgs_history_bytes bytes.
+ */
+void lbfgs_history_save(const lbfgs_history_t *history, void *buffer);
+
+/**
+ * Replace the pairs held with those from ::lbfgs_history_save.
+ *
+ *  @param  history     Storage from ::lbfgs_history_new.
+ *  @param  buffer      Buffer filled by ::lbfgs_history_save.
+ *  @param  bytes       Size of the buffer.
+ *  @retval int         Zero on success, otherwise an error code, leaving
+ *                      the history empty.
+ */
+int lbfgs_history_load(lbfgs_history_t *history, const void *buffer,
+                       size_t bytes);
+
+/**
+ * Free storage allocated by ::lbfgs_history_new, with its pairs.
+ *
+ *  @param  history     Storage from ::lbfgs_history_new.
+ */
+void lbfgs_history_free(lbfgs_history_t *history);
+
 /**
  * Free an array of variables.
  *  
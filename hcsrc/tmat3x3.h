@@ -0,0 +1,183 @@
+// Vagabond
+// Copyright (C) 2019 Helen Ginn
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+// Please email: vagabond @ hginn.co.uk for more details.
+
+
+#ifndef __vagabond__tmat3x3__
+#define __vagabond__tmat3x3__
+
+#include "mat3x3.h"
+#include "tvec3.h"
+
+/* mat3x3 for any number type, most usefully Dual<N>; see tvec3.h. The
+ * functions below share their names and behaviour with those for
+ * mat3x3. */
+
+template <class T>
+struct tmat3x3
+{
+	T vals[9];
+};
+
+/** Identity matrix */
+template <class T>
+inline tmat3x3<T> make_tmat3x3()
+{
+	tmat3x3<T> mat;
+
+	for (int i = 0; i < 9; i++)
+	{
+		mat.vals[i] = T(i % 4 == 0 ? 1 : 0);
+	}
+
+	return mat;
+}
+
+/** A constant copy of a plain mat3x3 */
+template <class T>
+inline tmat3x3<T> tmat3x3_from_mat3x3(const mat3x3 &mat)
+{
+	tmat3x3<T> m;
+
+	for (int i = 0; i < 9; i++)
+	{
+		m.vals[i] = T(mat.vals[i]);
+	}
+
+	return m;
+}
+
+/** The values alone, dropping any derivatives */
+template <class T>
+inline mat3x3 mat3x3_from_tmat3x3(const tmat3x3<T> &mat)
+{
+	mat3x3 m;
+
+	for (int i = 0; i < 9; i++)
+	{
+		m.vals[i] = dual_value(mat.vals[i]);
+	}
+
+	return m;
+}
+
+template <class T>
+inline tvec3<T> mat3x3_mult_vec(const tmat3x3<T> &mat, const tvec3<T> &vec)
+{
+	const T *m = mat.vals;
+	return make_tvec3(m[0] * vec.x + m[1] * vec.y + m[2] * vec.z,
+	                  m[3] * vec.x + m[4] * vec.y + m[5] * vec.z,
+	                  m[6] * vec.x + m[7] * vec.y + m[8] * vec.z);
+}
+
+template <class T>
+inline tmat3x3<T> mat3x3_mult_mat3x3(const tmat3x3<T> &m1, 
+                                     const tmat3x3<T> &m2)
+{
+	tmat3x3<T> m;
+
+	for (int r = 0; r < 3; r++)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			m.vals[r * 3 + c] = (m1.vals[r * 3] * m2.vals[c] + 
+			                     m1.vals[r * 3 + 1] * m2.vals[3 + c] +
+			                     m1.vals[r * 3 + 2] * m2.vals[6 + c]);
+		}
+	}
+
+	return m;
+}
+
+template <class T>
+inline tmat3x3<T> mat3x3_transpose(const tmat3x3<T> &mat)
+{
+	tmat3x3<T> m;
+
+	for (int r = 0; r < 3; r++)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			m.vals[c * 3 + r] = mat.vals[r * 3 + c];
+		}
+	}
+
+	return m;
+}
+
+template <class T>
+inline T mat3x3_trace(const tmat3x3<T> &mat)
+{
+	return mat.vals[0] + mat.vals[4] + mat.vals[8];
+}
+
+template <class T>
+inline T mat3x3_determinant(const tmat3x3<T> &mat)
+{
+	const T *m = mat.vals;
+	return (m[0] * m[4] * m[8] + m[1] * m[5] * m[6] + m[2] * m[3] * m[7]
+	        - m[2] * m[4] * m[6] - m[1] * m[3] * m[8] - m[0] * m[5] * m[7]);
+}
+
+/** Rotation by radians about a unit axis */
+template <class T, class U>
+inline tmat3x3<T> mat3x3_unit_vec_rotation(const tvec3<T> &axis, 
+                                           const U &radians)
+{
+	tmat3x3<T> mat;
+	const T &x = axis.x;
+	const T &y = axis.y;
+	const T &z = axis.z;
+
+	T cosa = T(cos(radians));
+	T sina = T(sin(radians));
+	T inv = 1.0 - cosa;
+
+	mat.vals[0] = cosa + x * x * inv;
+	mat.vals[1] = x * y * inv - z * sina;
+	mat.vals[2] = x * z * inv + y * sina;
+
+	mat.vals[3] = y * x * inv + z * sina;
+	mat.vals[4] = cosa + y * y * inv;
+	mat.vals[5] = z * y * inv - x * sina;
+
+	mat.vals[6] = z * x * inv - y * sina;
+	mat.vals[7] = z * y * inv + x * sina;
+	mat.vals[8] = cosa + z * z * inv;
+
+	return mat;
+}
+
+/** Rotations about x, then y, then z, as mat3x3_rotate (named apart
+ * so that doubles do not pick the plain version) */
+template <class T>
+inline tmat3x3<T> tmat3x3_rotate(const T &alpha, const T &beta, 
+                                const T &gamma)
+{
+	tvec3<T> xAxis = make_tvec3(T(1.0), T(0.0), T(0.0));
+	tvec3<T> yAxis = make_tvec3(T(0.0), T(1.0), T(0.0));
+	tvec3<T> zAxis = make_tvec3(T(0.0), T(0.0), T(1.0));
+
+	tmat3x3<T> xRot = mat3x3_unit_vec_rotation(xAxis, alpha);
+	tmat3x3<T> yRot = mat3x3_unit_vec_rotation(yAxis, beta);
+	tmat3x3<T> xyRot = mat3x3_mult_mat3x3(yRot, xRot);
+	tmat3x3<T> zRot = mat3x3_unit_vec_rotation(zAxis, gamma);
+
+	return mat3x3_mult_mat3x3(zRot, xyRot);
+}
+
+#endif
@@ -0,0 +1,160 @@
+// Vagabond
+// Copyright (C) 2019 Helen Ginn
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+// Please email: vagabond @ hginn.co.uk for more details.
+
+
+#ifndef __vagabond__tvec3__
+#define __vagabond__tvec3__
+
+#include "vec3.h"
+#include "Dual.h"
+
+/* vec3 for any number type, most usefully Dual<N>, so that geometry
+ * written once as a template can be differentiated. The functions below
+ * share their names and behaviour with those for vec3. */
+
+template <class T>
+struct tvec3
+{
+	T x;
+	T y;
+	T z;
+};
+
+template <class T>
+inline tvec3<T> make_tvec3(const T &x, const T &y, const T &z)
+{
+	tvec3<T> vec;
+	vec.x = x;
+	vec.y = y;
+	vec.z = z;
+
+	return vec;
+}
+
+/** A constant copy of a plain vec3 */
+template <class T>
+inline tvec3<T> tvec3_from_vec3(const vec3 &vec)
+{
+	return make_tvec3<T>(T(vec.x), T(vec.y), T(vec.z));
+}
+
+/** The values alone, dropping any derivatives */
+template <class T>
+inline vec3 vec3_from_tvec3(const tvec3<T> &vec)
+{
+	return make_vec3(dual_value(vec.x), dual_value(vec.y), 
+	                 dual_value(vec.z));
+}
+
+template <class T>
+inline T vec3_sqlength(const tvec3<T> &vec)
+{
+	return (vec.x * vec.x + vec.y * vec.y + vec.z * vec.z);
+}
+
+template <class T>
+inline T vec3_length(const tvec3<T> &vec)
+{
+	return sqrt(vec3_sqlength(vec));
+}
+
+template <class T, class U>
+inline void vec3_mult(tvec3<T> *vec, const U &mult)
+{
+	vec->x *= mult;
+	vec->y *= mult;
+	vec->z *= mult;
+}
+
+template <class T, class U>
+inline void vec3_set_length(tvec3<T> *vec, const U &length)
+{
+	T now = vec3_length(*vec);
+	vec3_mult(vec, length / now);
+}
+
+template <class T>
+inline tvec3<T> vec3_add_vec3(const tvec3<T> &aVec, const tvec3<T> &bVec)
+{
+	return make_tvec3(aVec.x + bVec.x, aVec.y + bVec.y, aVec.z + bVec.z);
+}
+
+template <class T>
+inline void vec3_add_to_vec3(tvec3<T> *bVec, const tvec3<T> &aVec)
+{
+	bVec->x += aVec.x;
+	bVec->y += aVec.y;
+	bVec->z += aVec.z;
+}
+
+/** "to minus from", as vec3_subtract_vec3 */
+template <class T>
+inline tvec3<T> vec3_subtract_vec3(const tvec3<T> &to, 
+                                   const tvec3<T> &from)
+{
+	return make_tvec3(to.x - from.x, to.y - from.y, to.z - from.z);
+}
+
+template <class T>
+inline void vec3_subtract_from_vec3(tvec3<T> *to, const tvec3<T> &from)
+{
+	to->x -= from.x;
+	to->y -= from.y;
+	to->z -= from.z;
+}
+
+template <class T>
+inline T vec3_dot_vec3(const tvec3<T> &aVec, const tvec3<T> &bVec)
+{
+	return aVec.x * bVec.x + aVec.y * bVec.y + aVec.z * bVec.z;
+}
+
+template <class T>
+inline tvec3<T> vec3_cross_vec3(const tvec3<T> &aVec, const tvec3<T> &bVec)
+{
+	return make_tvec3(aVec.y * bVec.z - aVec.z * bVec.y,
+	                  aVec.z * bVec.x - aVec.x * bVec.z,
+	                  aVec.x * bVec.y - aVec.y * bVec.x);
+}
+
+template <class T>
+inline T vec3_cosine_with_vec3(const tvec3<T> &aVec, const tvec3<T> &bVec)
+{
+	return vec3_dot_vec3(aVec, bVec) / 
+	(vec3_length(aVec) * vec3_length(bVec));
+}
+
+template <class T>
+inline T vec3_angle_with_vec3(const tvec3<T> &aVec, const tvec3<T> &bVec)
+{
+	return acos(vec3_cosine_with_vec3(aVec, bVec));
+}
+
+/** Angle at bVec, as vec3_angle_from_three_points */
+template <class T>
+inline T vec3_angle_from_three_points(const tvec3<T> &aVec, 
+                                      const tvec3<T> &bVec,
+                                      const tvec3<T> &cVec)
+{
+	tvec3<T> aToB = vec3_subtract_vec3(bVec, aVec);
+	tvec3<T> aToC = vec3_subtract_vec3(bVec, cVec);
+
+	return vec3_angle_with_vec3(aToB, aToC);
+}
+
+#endif